@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "embed.h"
+#include "embed-common.h"
+#include "instance.h"
+#include "lgf-loader.h"
+#include "snapshot.h"
+#include "utils.h"
+
+
+struct BatchOptions
+{
+  std::vector<std::string> methods;  // every input is embedded with each
+  size_t cores = 0;  // core budget shared by the jobs, 0: all cores
+  std::string topology_file;  // lscpu -p dump applied to every input
+};
+
+
+inline std::vector<std::string> get_batch_inputs(const std::string& path)
+{
+  // a directory (its .lgf and .snap files, by name) or a list file (one
+  // path per line, '#' starts a comment line)
+  std::vector<std::string> inputs;
+  if (std::filesystem::is_directory(path))
+    {
+      for (const auto& entry : std::filesystem::directory_iterator(path))
+	if (entry.is_regular_file() &&
+	    (entry.path().extension() == ".lgf" || entry.path().extension() == ".snap"))
+	  inputs.push_back(entry.path().string());
+      std::sort(inputs.begin(), inputs.end());
+      return inputs;
+    }
+
+  std::ifstream in(path);
+  if (!in)
+    throw std::runtime_error(path + ": cannot open batch input list");
+  std::string line;
+  while (std::getline(in, line))
+    {
+      line.erase(0, line.find_first_not_of(" \t\r"));
+      line.erase(line.find_last_not_of(" \t\r") + 1);
+      if (line.empty() == false && line[0] != '#')
+	inputs.push_back(line);
+    }
+  return inputs;
+}
+
+
+struct _BatchInput
+{
+  // an input shared by its jobs: loaded by the first one to start, freed
+  // by the last one to finish
+  std::string path;
+  std::once_flag loaded;
+  std::shared_ptr<Instance> inst;
+  std::string error;
+  size_t load_us = 0;
+  size_t pending = 0;  // guarded by the scheduler lock
+};
+
+
+struct _BatchJob
+{
+  size_t input;
+  std::string method;
+  size_t cores;  // reserved from the budget while running
+  bool started = false;
+};
+
+
+inline size_t run_batch(const std::vector<std::string>& inputs,
+			const EmbedOptions& defaults,
+			const BatchOptions& batch_opts,
+			std::ostream& out)
+{
+  // embeds every input with every method on a worker pool, and streams
+  // a JSON record per job to out as jobs finish; jobs only start while
+  // their core reservation fits the budget; ilp solves reserve their
+  // solver threads (all cores by default) if the MIP backend takes a
+  // thread count, and a single core otherwise; returns the failed jobs
+  size_t budget = batch_opts.cores;
+  if (budget == 0)
+    budget = std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<_BatchInput> batch_inputs(inputs.size());
+  std::vector<_BatchJob> jobs;
+  for (size_t i = 0; i < inputs.size(); ++i)
+    {
+      batch_inputs[i].path = inputs[i];
+      for (std::string method : batch_opts.methods)
+	{
+	  for (auto& c : method)
+	    c = std::tolower(c);
+	  _BatchJob job;
+	  job.input = i;
+	  job.method = method;
+	  if (method == "ilp" && ilp_solver_params_supported() == false)
+	    job.cores = 1;
+	  else if (defaults.threads > 0)
+	    job.cores = defaults.threads;
+	  else
+	    job.cores = (method == "ilp") ? budget : 1;
+	  job.cores = std::min(job.cores, budget);
+	  jobs.push_back(job);
+	  ++batch_inputs[i].pending;
+	}
+    }
+
+  std::mutex lock;
+  std::condition_variable cv;
+  size_t free_cores = budget;
+  size_t next = 0;  // first job not started yet
+  size_t failed = 0;
+
+  auto run_job = [&](const _BatchJob& job) {
+    _BatchInput& input = batch_inputs[job.input];
+    std::call_once(input.loaded, [&input, &batch_opts]() {
+	auto t_before = std::chrono::steady_clock::now();
+	try {
+	  auto inst = std::make_shared<Instance>();
+	  if (is_instance_snapshot(input.path))
+	    load_instance_snapshot(*inst, input.path);
+	  else
+	    load_instance_lgf(*inst, input.path);
+	  if (batch_opts.topology_file.empty() == false)
+	    load_topology(*inst, batch_opts.topology_file);
+	  input.inst = inst;
+	} catch (std::exception& error) {
+	  input.error = error.what();
+	}
+	input.load_us = std::chrono::duration_cast<std::chrono::microseconds>(
+	  std::chrono::steady_clock::now() - t_before).count();
+      });
+    std::shared_ptr<Instance> inst = input.inst;
+
+    std::string record = "{\"file\":" + json_string(input.path) +
+      ",\"method\":" + json_string(job.method) +
+      ",\"maxflow\":" + (defaults.max_obj_func ? "true" : "false") +
+      ",\"cores\":" + std::to_string(job.cores);
+    bool ok = false;
+    if (inst == nullptr)
+      record += ",\"status\":\"error\",\"message\":" + json_string(input.error);
+    else
+      {
+	EmbedOptions opts = defaults;
+	opts.method = job.method;
+	opts.show_solver_log = false;
+	opts.threads = job.cores;
+	record += ",\"modules\":" + std::to_string(inst->modules.size()) +
+	  ",\"flows\":" + std::to_string(inst->flows.size()) +
+	  ",\"cpus\":" + std::to_string(inst->cpus.size()) +
+	  ",\"load_us\":" + std::to_string(input.load_us);
+	auto t_before = std::chrono::steady_clock::now();
+	try {
+	  EmbeddingResult res = embed_with_method(inst->dfg, inst->cg, inst->cpus,
+						  inst->flows, inst->modules, opts);
+	  auto t_after = std::chrono::steady_clock::now();
+	  record += ",\"status\":\"ok\",\"value\":" + std::to_string(res.sol_value);
+	  if (res.gap >= 0)
+	    record += ",\"gap\":" + std::to_string(res.gap);
+	  record += ",\"time_us\":" + std::to_string(
+	    std::chrono::duration_cast<std::chrono::microseconds>(t_after - t_before).count());
+	  ok = true;
+	} catch (std::exception& error) {
+	  record += ",\"status\":\"error\",\"message\":" + json_string(error.what());
+	}
+      }
+    record += "}";
+
+    std::lock_guard<std::mutex> guard(lock);
+    out << record << std::endl;
+    if (ok == false)
+      ++failed;
+    if (--input.pending == 0)
+      input.inst.reset();
+  };
+
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+      {
+	// the first waiting job that fits the free cores
+	while (next < jobs.size() && jobs[next].started)
+	  ++next;
+	if (next == jobs.size())
+	  break;
+	size_t j = next;
+	while (j < jobs.size() && (jobs[j].started || jobs[j].cores > free_cores))
+	  ++j;
+	if (j == jobs.size())
+	  {
+	    cv.wait(guard);
+	    continue;
+	  }
+	jobs[j].started = true;
+	free_cores -= jobs[j].cores;
+	guard.unlock();
+	run_job(jobs[j]);
+	guard.lock();
+	free_cores += jobs[j].cores;
+	cv.notify_all();
+      }
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < std::min(budget, jobs.size()); ++t)
+    pool.push_back(std::thread(worker));
+  worker();
+  for (auto& t : pool)
+    t.join();
+  return failed;
+}
+
+
+#endif  // BATCH_H
@@ -18,10 +18,12 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include <memory>
 #include <vector>
 #include <sstream>
 
 #include "module.h"
+#include "topology.h"
 #include "utils.h"
 
 
@@ -41,6 +43,15 @@ class Cpu
   const float& capacity() const { return capacity_; }
   const float& load() const { return load_; }
   const std::vector<Module>& modules() const { return modules_; }
+  // topology shared by the cpus of an instance, null: every crossing
+  // costs 1
+  const Topology* topology() const { return topology_.get(); }
+  const std::shared_ptr<const Topology>& shared_topology() const { return topology_; }
+
+  void set_topology(const std::shared_ptr<const Topology>& topology)
+  {
+    topology_ = topology;
+  }
 
   void add_module(const Module& mod)
   {
@@ -53,13 +64,14 @@ class Cpu
   float capacity_ = 0;
   float load_ = 0;
   std::vector<Module> modules_;
+  std::shared_ptr<const Topology> topology_;
 };
 
-std::ostream& operator<<(std::ostream& out, const Cpu& c)
+inline std::ostream& operator<<(std::ostream& out, const Cpu& c)
 {
-  return out << "CPU" << c.id()
-	     << " (" << c.load() << "/" << c.capacity() << "):  "
-	     << print_modules(c.modules());
+  out << "CPU" << c.id()
+      << " (" << c.load() << "/" << c.capacity() << "):  ";
+  return print_modules(out, c.modules());
 }
 
 #endif  // CPU_H
@@ -0,0 +1,594 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// behaviour checks of the embedding methods, run by make check: every
+// check builds small (generated) instances and tests a property the
+// methods must keep, independently of the MIP backend
+
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "embed.h"
+#include "embed-bestfitdec.h"
+#include "embed-common.h"
+#include "embed-presolve.h"
+#include "generate.h"
+#include "instance.h"
+#include "topology.h"
+
+using namespace lemon;
+
+
+static int failed_checks = 0;
+
+
+static void check(bool cond, const std::string& what)
+{
+  if (cond == false)
+    {
+      std::cerr << "FAIL: " << what << std::endl;
+      ++failed_checks;
+    }
+}
+
+
+static void set_two_socket_topology(Instance& inst)
+{
+  // two sockets of two cores each, far crossings between the sockets
+  const size_t n = inst.cpus.size();
+  std::vector<size_t> cores, numas, sockets;
+  for (size_t c = 0; c < n; ++c)
+    {
+      cores.push_back(c);
+      numas.push_back(c * 4 / n);
+      sockets.push_back(c * 2 / n);
+    }
+  auto topology = std::make_shared<const Topology>(cores, numas, sockets,
+						   Topology::Costs{{1, 1, 2, 20}});
+  for (auto& cpu : inst.cpus)
+    cpu.set_topology(topology);
+}
+
+
+static bool valid_mapping(const Instance& inst, const std::vector<size_t>& mapping)
+{
+  // complete, within the cpu capacities and free of conflicts
+  if (mapping.size() != inst.modules.size())
+    return false;
+  std::vector<float> loads(inst.cpus.size(), 0);
+  for (const auto& module : inst.modules)
+    {
+      size_t cpu = mapping[inst.dfg.id(module.node())];
+      if (cpu >= inst.cpus.size())
+	return false;
+      loads[cpu] += module.weight();
+    }
+  for (size_t cpu = 0; cpu < inst.cpus.size(); ++cpu)
+    if (loads[cpu] > inst.cpus[cpu].capacity() * (1 + 1e-6f))
+      return false;
+  for (SmartGraph::EdgeIt e(inst.cg); e != INVALID; ++e)
+    if (mapping[inst.cg.id(inst.cg.u(e))] == mapping[inst.cg.id(inst.cg.v(e))])
+      return false;
+  return true;
+}
+
+
+static std::pair<long, long> objective(const Instance& inst,
+				       const std::vector<size_t>& mapping,
+				       bool max_obj_func)
+{
+  // the selected objective, ties broken by the sum with -maxflow
+  long sum = get_flow_crossings(inst.dfg, mapping, inst.flows, false,
+				get_topology(inst.cpus));
+  long max = get_flow_crossings(inst.dfg, mapping, inst.flows, true,
+				get_topology(inst.cpus));
+  return max_obj_func ? std::make_pair(max, sum) : std::make_pair(sum, 0L);
+}
+
+
+static bool refine_keeps(const Instance& inst, const EmbeddingResult& start,
+			 bool max_obj_func, unsigned seed)
+{
+  RefineOptions opts;
+  opts.iterations = 2000;
+  opts.time_limit_ms = 10000;
+  opts.seed = seed;
+  EmbeddingResult res = refine_embedding(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					 inst.modules, start, max_obj_func, opts);
+  return valid_mapping(inst, res.mapping) &&
+    objective(inst, res.mapping, max_obj_func) <=
+    objective(inst, start.mapping, max_obj_func);
+}
+
+
+static void check_refine_never_worsens()
+{
+  // refining a mapping never makes it worse: with -maxflow (max, sum) is
+  // compared lexicographically, otherwise the sum alone
+  for (unsigned seed = 0; seed < 8; ++seed)
+    for (bool max_obj_func : {false, true})
+      {
+	Instance inst;
+	generate_instance(inst, "layered:n=60,L=6,f=12,c=8,k=20", seed);
+	if (seed % 2 == 1)
+	  set_two_socket_topology(inst);
+
+	std::default_random_engine generator(seed);
+	EmbeddingResult start = embed_random(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					     inst.modules, max_obj_func, generator);
+	check(refine_keeps(inst, start, max_obj_func, seed),
+	      "refine worsened a random mapping (seed " + std::to_string(seed) +
+	      (max_obj_func ? ", -maxflow)" : ")"));
+      }
+
+  // the (max, sum) optimum (21, 41) of a two socket instance, a weighted
+  // max*3+sum energy prefers (22, 22)
+  Instance inst;
+  _InstanceBuilder b(inst);
+  for (int i = 0; i < 5; ++i)
+    b.add_module("m" + std::to_string(i), 1);
+  b.add_flow("a", {1, 0, 3, 4});
+  b.add_flow("b", {4, 0});
+  for (auto c : {std::make_pair(0, 2), std::make_pair(0, 3), std::make_pair(1, 3),
+		 std::make_pair(1, 4), std::make_pair(3, 4)})
+    b.add_conflict(c.first, c.second);
+  b.finish(4, 2, 0);
+  auto topology = std::make_shared<const Topology>(std::vector<size_t>{0, 1, 2, 3},
+						   std::vector<size_t>{0, 0, 1, 1},
+						   std::vector<size_t>{0, 0, 1, 1},
+						   Topology::Costs{{1, 1, 1, 20}});
+  for (auto& cpu : inst.cpus)
+    cpu.set_topology(topology);
+
+  EmbeddingResult start;
+  start.mapping = {0, 0, 1, 1, 2};
+  for (unsigned seed = 0; seed < 8; ++seed)
+    check(refine_keeps(inst, start, true, seed),
+	  "refine worsened the (max, sum) optimum (seed " + std::to_string(seed) + ")");
+}
+
+
+static void check_smt_siblings_are_cheapest()
+{
+  // with the default costs a crossing between SMT siblings is strictly
+  // cheaper than one between cores, so refine packs a flow onto a core
+  Instance inst;
+  _InstanceBuilder b(inst);
+  for (int i = 0; i < 4; ++i)
+    b.add_module("m" + std::to_string(i), 1);
+  b.add_flow("a", {0, 1, 2, 3});
+  b.finish(4, 2, 0);
+  auto topology = std::make_shared<const Topology>(std::vector<size_t>{0, 0, 1, 1},
+						   std::vector<size_t>{0, 0, 0, 0},
+						   std::vector<size_t>{0, 0, 0, 0});
+  for (auto& cpu : inst.cpus)
+    cpu.set_topology(topology);
+  check(topology->cost(0, 1) < topology->cost(0, 2),
+	"SMT siblings do not cross cheaper than cores");
+
+  EmbeddingResult start;
+  start.mapping = {0, 2, 1, 3};
+  start.sol_value = objective(inst, start.mapping, false).first;
+  RefineOptions opts;
+  opts.iterations = 20000;
+  EmbeddingResult res = refine_embedding(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					 inst.modules, start, false, opts);
+  check(valid_mapping(inst, res.mapping) && res.sol_value == 0 &&
+	objective(inst, res.mapping, false).first == 0,
+	"refine did not keep a flow on the SMT siblings of a core");
+}
+
+
+static void check_refine_scales_with_rates()
+{
+  // the annealing temperature follows the magnitude of the deltas: scaling
+  // every flow rate leaves the search, and so its result, unchanged
+  for (unsigned seed = 0; seed < 4; ++seed)
+    {
+      Instance inst;
+      generate_instance(inst, "layered:n=60,L=6,f=12,c=8,k=20", seed);
+      if (seed % 2 == 1)
+	set_two_socket_topology(inst);
+      Instance scaled;
+      generate_instance(scaled, "layered:n=60,L=6,f=12,c=8,k=20", seed);
+      if (seed % 2 == 1)
+	set_two_socket_topology(scaled);
+      scaled.flows.clear();
+      for (const auto& flow : inst.flows)
+	scaled.flows.push_back(Flow(flow.name(), flow.modules(), flow.rate() * 1024));
+
+      std::default_random_engine generator(seed);
+      EmbeddingResult start = embed_random(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					   inst.modules, false, generator);
+      RefineOptions opts;
+      opts.iterations = 5000;
+      opts.time_limit_ms = 10000;
+      opts.seed = seed;
+      EmbeddingResult res = refine_embedding(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					     inst.modules, start, false, opts);
+      EmbeddingResult res_scaled = refine_embedding(scaled.dfg, scaled.cg, scaled.cpus,
+						    scaled.flows, scaled.modules, start,
+						    false, opts);
+      check(res.mapping == res_scaled.mapping,
+	    "refine depends on the scale of the flow rates (seed " +
+	    std::to_string(seed) + ")");
+    }
+}
+
+
+static void check_greedy_places_a_module_subset()
+{
+  // the greedy embedder places exactly the given modules, which may be a
+  // subset of the dfg nodes, e.g., a decomposition part
+  for (unsigned seed = 0; seed < 8; ++seed)
+    for (bool max_obj_func : {false, true})
+      {
+	Instance inst;
+	generate_instance(inst, "layered:n=60,L=6,f=12,c=8,k=20", seed);
+	std::vector<Module> subset;
+	for (size_t k = 0; k < inst.modules.size(); k += 2)
+	  subset.push_back(inst.modules[k]);
+	EmbeddingResult res = embed_greedy(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					   subset, max_obj_func);
+
+	std::vector<size_t> expected(inst.modules.size(), UNMAPPED);
+	std::vector<float> loads(inst.cpus.size(), 0);
+	bool ok = res.mapping.size() == inst.modules.size();
+	for (const auto& module : subset)
+	  {
+	    size_t v = inst.dfg.id(module.node());
+	    ok = ok && res.mapping[v] < inst.cpus.size();
+	    if (ok)
+	      {
+		expected[v] = res.mapping[v];
+		loads[res.mapping[v]] += module.weight();
+	      }
+	  }
+	ok = ok && res.mapping == expected;
+	for (size_t cpu = 0; ok && cpu < inst.cpus.size(); ++cpu)
+	  ok = loads[cpu] <= inst.cpus[cpu].capacity() * (1 + 1e-6f);
+	for (SmartGraph::EdgeIt e(inst.cg); ok && e != INVALID; ++e)
+	  {
+	    size_t u = res.mapping[inst.cg.id(inst.cg.u(e))];
+	    ok = u == UNMAPPED || u != res.mapping[inst.cg.id(inst.cg.v(e))];
+	  }
+	check(ok, "greedy misplaced a module subset (seed " + std::to_string(seed) +
+	      (max_obj_func ? ", -maxflow)" : ")"));
+      }
+}
+
+
+static void check_repair_keeps_the_budget()
+{
+  // re-embedding after a cpu failure moves the modules of the failed cpu
+  // to surviving ones and migrates at most the budget of other modules
+  for (unsigned seed = 0; seed < 8; ++seed)
+    for (bool max_obj_func : {false, true})
+      {
+	Instance inst;
+	generate_instance(inst, "layered:n=60,L=6,f=12,c=8,k=20,s=2", seed);
+	if (seed % 2 == 1)
+	  set_two_socket_topology(inst);
+	std::string what = " (seed " + std::to_string(seed) +
+	  (max_obj_func ? ", -maxflow)" : ")");
+
+	EmbeddingResult prev = embed_bestfitdecreasing(inst.dfg, inst.cg, inst.cpus,
+						       inst.flows, inst.modules,
+						       max_obj_func);
+	ReembedOptions opts;
+	opts.failed = {seed % inst.cpus.size()};
+	opts.budget = 3;
+	ReembedStat st;
+	EmbeddingResult res = repair_embedding(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					       inst.modules, prev.mapping, max_obj_func,
+					       opts, &st);
+
+	check(valid_mapping(inst, res.mapping), "repair returned an invalid mapping" + what);
+	size_t migrated = 0, left = 0;
+	for (size_t v = 0; v < res.mapping.size(); ++v)
+	  {
+	    if (res.mapping[v] == opts.failed[0])
+	      ++left;
+	    else if (prev.mapping[v] != opts.failed[0] && res.mapping[v] != prev.mapping[v])
+	      ++migrated;
+	  }
+	check(left == 0, "repair left modules on the failed cpu" + what);
+	check(migrated <= size_t(opts.budget) && migrated == st.migrated,
+	      "repair migrated more modules than the budget" + what);
+	check(res.sol_value == objective(inst, res.mapping, max_obj_func).first,
+	      "repair reported a wrong objective value" + what);
+      }
+}
+
+
+static void check_reembed_heuristic_keeps_survivors()
+{
+  // re-embedding with a heuristic places the displaced modules on the
+  // capacity left by the surviving ones, which all stay in place
+  for (const std::string method : {"greedy", "bestfitdec", "roundrobin", "random"})
+    for (unsigned seed = 0; seed < 4; ++seed)
+      {
+	Instance inst;
+	generate_instance(inst, "layered:n=60,L=6,f=12,c=8,k=20,s=2", seed);
+	std::string what = " (" + method + ", seed " + std::to_string(seed) + ")";
+
+	EmbeddingResult prev = embed_bestfitdecreasing(inst.dfg, inst.cg, inst.cpus,
+						       inst.flows, inst.modules);
+	EmbedOptions opts;
+	opts.method = method;
+	opts.seed = seed;
+	ReembedOptions reembed_opts;
+	reembed_opts.failed = {seed % inst.cpus.size()};
+	reembed_opts.budget = 3;
+	EmbedStat st;
+	EmbeddingResult res = reembed_with_method(inst.dfg, inst.cg, inst.cpus, inst.flows,
+						  inst.modules, prev.mapping, opts,
+						  reembed_opts, &st);
+
+	check(valid_mapping(inst, res.mapping), "re-embedding returned an invalid mapping" + what);
+	size_t moved = 0, displaced = 0, left = 0;
+	for (size_t v = 0; v < res.mapping.size(); ++v)
+	  {
+	    if (prev.mapping[v] == reembed_opts.failed[0])
+	      ++displaced;
+	    if (res.mapping[v] == reembed_opts.failed[0])
+	      ++left;
+	    if (res.mapping[v] != prev.mapping[v] && prev.mapping[v] != reembed_opts.failed[0])
+	      ++moved;
+	  }
+	check(left == 0, "re-embedding left modules on the failed cpu" + what);
+	check(moved == 0 && displaced == st.reembed.displaced,
+	      "re-embedding migrated a module of a surviving cpu" + what);
+	check(res.sol_value == objective(inst, res.mapping, false).first,
+	      "re-embedding reported a wrong objective value" + what);
+      }
+}
+
+
+static void check_cpubins_keep_colliding_stamps()
+{
+  // bins of equal free capacity and equal random stamp are different
+  // bins: reseeding the generator makes take() draw the stamps the
+  // constructor drew, so that taken bins collide with untouched ones
+  std::vector<Cpu> cpus;
+  for (size_t c = 0; c < 8; ++c)
+    cpus.push_back(Cpu(c, 10 + c % 2));
+  std::default_random_engine generator(7);
+  CpuBins bins(cpus, &generator);
+  generator.seed(7);
+  for (size_t c = 1; c < cpus.size(); c += 2)
+    bins.take(c, 1);
+
+  for (size_t c = 0; c < cpus.size(); ++c)
+    check(bins.best_fit(10, [c](size_t id) { return id == c; }) == c,
+	  "cpu bins lost cpu " + std::to_string(c) + " on a stamp collision");
+}
+
+
+static void check_decomposed_gap_is_global()
+{
+  // parts embedded on capacity shares may claim a zero gap, the merged
+  // result must report its gap to the bound of the whole instance
+  for (bool max_obj_func : {false, true})
+    {
+      Instance inst;
+      generate_instance(inst, "layered:n=60,L=6,f=3,c=8", 1);
+      InstanceEmbedder embed = [max_obj_func](const Instance& sub) {
+	EmbeddingResult res = embed_bestfitdecreasing(sub.dfg, sub.cg, sub.cpus,
+						      sub.flows, sub.modules,
+						      max_obj_func);
+	res.gap = 0;
+	return res;
+      };
+      DecomposeStat st;
+      EmbeddingResult res = embed_decomposed(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					     inst.modules, embed, max_obj_func, 1, &st);
+      long bound = get_flow_crossings_lower_bound(inst.dfg, inst.cpus, inst.modules,
+						  FlowPaths(inst.dfg, inst.flows),
+						  get_conflict_adjacency(inst.dfg, inst.cg),
+						  max_obj_func);
+      std::string what = max_obj_func ? " (-maxflow)" : "";
+      check(st.components > 1, "the instance is not decomposed" + what);
+      check(res.gap == get_gap(res.sol_value, bound),
+	    "decomposed gap is not the one to the global lower bound" + what);
+    }
+}
+
+
+static void check_decomposed_parts_get_whole_cpus()
+{
+  // four pipelines of four modules of weight 3 on eight cpus of capacity
+  // 8: every module is heavier than a weight-proportional share of a cpu
+  // (2), on two whole cpus per part they all fit concurrently
+  Instance inst;
+  _InstanceBuilder b(inst);
+  for (int p = 0; p < 4; ++p)
+    {
+      std::vector<int> path;
+      for (int i = 0; i < 4; ++i)
+	path.push_back(b.add_module("p" + std::to_string(p) + "m" + std::to_string(i), 3));
+      b.add_flow("f" + std::to_string(p), path);
+    }
+  b.finish(8, 8, 0);
+
+  InstanceEmbedder embed = [](const Instance& sub) {
+    return embed_bestfitdecreasing(sub.dfg, sub.cg, sub.cpus, sub.flows, sub.modules);
+  };
+  DecomposeStat st;
+  EmbeddingResult res = embed_decomposed(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					 inst.modules, embed, false, 4, &st);
+  check(st.parts == 4 && st.resolved == 0 && st.undecomposed == false,
+	"decomposed parts did not fit their cpus");
+  check(valid_mapping(inst, res.mapping), "decomposed mapping is invalid");
+
+  // only infeasibility sends a part to the residual pass, other errors
+  // of the method are passed on
+  InstanceEmbedder failing = [](const Instance&) -> EmbeddingResult {
+    throw std::runtime_error("Optimal solution not found");
+  };
+  bool passed_on = false;
+  try {
+    embed_decomposed(inst.dfg, inst.cg, inst.cpus, inst.flows, inst.modules, failing,
+		     false, 4);
+  } catch (EmbeddingInfeasible&) {
+  } catch (std::runtime_error&) {
+    passed_on = true;
+  }
+  check(passed_on, "decompose took a solver failure for infeasibility");
+}
+
+
+static void check_presolve_rejects_oversized_clique()
+{
+  // a conflict clique larger than the number of cpus is rejected by the
+  // presolve with the modules of the clique, a fitting one sets min_cpus
+  for (int clique : {5, 4})
+    {
+      Instance inst;
+      _InstanceBuilder b(inst);
+      for (int i = 0; i < 8; ++i)
+	b.add_module("m" + std::to_string(i), 1);
+      b.add_flow("f", {0, 1, 2, 3, 4, 5, 6, 7});
+      for (int u = 0; u < clique; ++u)
+	for (int v = u + 1; v < clique; ++v)
+	  b.add_conflict(u, v);
+      b.finish(4, 8, 0);
+
+      std::string error;
+      PresolveStat st;
+      try {
+	presolve_instance(inst.dfg, inst.cg, inst.cpus, inst.modules, {}, &st);
+      } catch (std::runtime_error& e) {
+	error = e.what();
+      }
+      if (clique > 4)
+	check(error.find("5 mutually conflicting modules") != std::string::npos,
+	      "presolve did not reject a clique of 5 on 4 cpus: '" + error + "'");
+      else
+	check(error.empty() && st.largest_clique == 4 && st.min_cpus == 4,
+	      "presolve rejected a clique of 4 on 4 cpus or missed its size");
+    }
+}
+
+
+static std::pair<long, long> expanded_objective(const Instance& inst,
+						const std::vector<size_t>& mapping)
+{
+  // (sum, max) computed flow by flow, without flow classes
+  const Topology* topology = get_topology(inst.cpus);
+  long sum = 0, max = 0;
+  for (const auto& flow : inst.flows)
+    {
+      long c = 0;
+      const std::vector<Module>& path = flow.modules();
+      for (size_t i = 0; i + 1 < path.size(); ++i)
+	{
+	  size_t a = mapping[inst.dfg.id(path[i].node())];
+	  size_t b = mapping[inst.dfg.id(path[i+1].node())];
+	  c += topology != nullptr ? topology->cost(a, b) : a != b;
+	}
+      sum += flow.rate() * c;
+      max = std::max(max, flow.rate() * c);
+    }
+  return std::make_pair(sum, max);
+}
+
+
+static void check_flow_classes_keep_the_objective()
+{
+  // duplicated flows of different rates are merged into flow classes;
+  // the objectives and the incremental evaluator must still match the
+  // flows one by one
+  for (unsigned seed = 0; seed < 8; ++seed)
+    {
+      Instance inst;
+      generate_instance(inst, "layered:n=40,L=5,f=10,c=6", seed);
+      if (seed % 2 == 1)
+	set_two_socket_topology(inst);
+      std::default_random_engine generator(seed);
+      std::uniform_int_distribution<long> rnd_rate(1, 5);
+      std::vector<Flow> flows;
+      for (const auto& flow : inst.flows)
+	for (int copy = 0; copy < 3; ++copy)
+	  flows.push_back(Flow(flow.name() + "-" + std::to_string(copy), flow.modules(),
+			       rnd_rate(generator)));
+      inst.flows = flows;
+      std::string what = " (seed " + std::to_string(seed) + ")";
+
+      FlowPaths paths(inst.dfg, inst.flows);
+      check(paths.size() * 3 <= paths.flow_num(), "duplicated flows are not merged" + what);
+
+      EmbeddingResult res = embed_random(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					 inst.modules, false, generator);
+      std::pair<long, long> expanded = expanded_objective(inst, res.mapping);
+      check(get_flow_crossings(inst.dfg, res.mapping, inst.flows, false,
+			       get_topology(inst.cpus)) == expanded.first &&
+	    get_flow_crossings(inst.dfg, res.mapping, inst.flows, true,
+			       get_topology(inst.cpus)) == expanded.second,
+	    "flow class objective differs from the expanded flows" + what);
+
+      DeltaEvaluator eval(inst.dfg, inst.cpus, inst.modules, paths, res.mapping);
+      std::uniform_int_distribution<size_t> rnd_module(0, inst.modules.size() - 1);
+      std::uniform_int_distribution<size_t> rnd_cpu(0, inst.cpus.size() - 1);
+      bool same = true;
+      for (int it = 0; it < 200; ++it)
+	{
+	  size_t v = rnd_module(generator);
+	  size_t cpu = rnd_cpu(generator);
+	  if (cpu == eval.mapping()[v])
+	    continue;
+	  DeltaEvaluator::Delta d = eval.move_delta(v, cpu);
+	  long sum = eval.sum(), max = eval.max();
+	  eval.move(v, cpu);
+	  expanded = expanded_objective(inst, eval.mapping());
+	  same = same && eval.sum() == expanded.first && eval.max() == expanded.second &&
+	    sum + d.sum == eval.sum() && max + d.max == eval.max();
+	}
+      check(same, "incremental flow class objective differs from the expanded flows" + what);
+    }
+}
+
+
+int main()
+{
+  check_refine_never_worsens();
+  check_refine_scales_with_rates();
+  check_smt_siblings_are_cheapest();
+  check_greedy_places_a_module_subset();
+  check_repair_keeps_the_budget();
+  check_reembed_heuristic_keeps_survivors();
+  check_cpubins_keep_colliding_stamps();
+  check_decomposed_gap_is_global();
+  check_decomposed_parts_get_whole_cpus();
+  check_presolve_rejects_oversized_clique();
+  check_flow_classes_keep_the_objective();
+
+  if (failed_checks > 0)
+    {
+      std::cerr << failed_checks << " check(s) failed" << std::endl;
+      return 1;
+    }
+  std::cout << "all checks passed" << std::endl;
+  return 0;
+}
@@ -15,24 +15,29 @@
  *  along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include<chrono>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <lemon/arg_parser.h>
-#include <lemon/lgf_reader.h>
-#include <lemon/lgf_writer.h>
 #include <lemon/smart_graph.h>
 
+#include "batch.h"
 #include "cpu.h"
-#include "embed-bestfitdec.h"
+#include "embed.h"
 #include "embed-common.h"
-#include "embed-greedy.h"
-#include "embed-ilp.h"
-#include "embed-random.h"
-#include "embed-roundrobin.h"
 #include "flow.h"
+#include "generate.h"
+#include "instance.h"
+#include "lgf-loader.h"
+#include "mapping.h"
+#include "metrics.h"
 #include "module.h"
+#include "report.h"
+#include "service.h"
+#include "snapshot.h"
 #include "utils.h"
 
 using namespace lemon;
@@ -46,6 +51,31 @@ int main(int argc, char **argv)
   std::string method = "ilp";
   bool max_obj_func = false;
   bool show_solver_log = false;
+  bool refine = false;
+  int refine_iters = 1000000;
+  int refine_time = 100;
+  int starts = 1;
+  int threads = 0;
+  int seed = 0;
+  double time_limit = 0;
+  double mip_gap = 0;
+  std::string warm_start = "greedy";
+  bool decompose = false;
+  std::string gen_spec;
+  std::string snapshot_file;
+  std::string prev_mapping_file;
+  std::string failed_cpus;
+  int migrations = 0;
+  std::string mapping_file;
+  std::string serve;
+  std::string topology_file;
+  std::string batch;
+  std::string batch_methods;
+  std::string batch_out = "-";
+  int batch_cores = 0;
+  std::string format = "org";
+  bool quiet = false;
+  bool show_metrics = false;
 
   ap.refOption("infile",
 	       "Input pipeline desrciption LGF",
@@ -60,211 +90,324 @@ int main(int argc, char **argv)
 	       max_obj_func,
 	       false);
   ap.refOption("method",
-	       "Embedding method to use. [ilp, bestfitdec, random, roundrobin]",
+	       "Embedding method to use. [ilp, greedy, bestfitdec, random, roundrobin,\n"
+	       "repair (only with -mapping)]",
 	       method,
 	       false);
+  ap.refOption("refine",
+	       "Post-optimize the embedding with local search",
+	       refine,
+	       false);
+  ap.refOption("refineiters",
+	       "Iteration budget of the local search",
+	       refine_iters,
+	       false);
+  ap.refOption("refinetime",
+	       "Time budget of the local search [ms]",
+	       refine_time,
+	       false);
+  ap.refOption("starts",
+	       "Number of randomized starts to pick the best of [random, bestfitdec]",
+	       starts,
+	       false);
+  ap.refOption("threads",
+	       "Number of worker threads, or ILP solver threads (default: all cores)",
+	       threads,
+	       false);
+  ap.refOption("seed",
+	       "Seed of randomized methods (default: random)",
+	       seed,
+	       false);
+  ap.refOption("timelimit",
+	       "Time limit of the ILP solver [s] (default: no limit)",
+	       time_limit,
+	       false);
+  ap.refOption("mipgap",
+	       "Accepted relative gap of the ILP solution",
+	       mip_gap,
+	       false);
+  ap.refOption("warmstart",
+	       "Heuristic providing the ILP incumbent. [greedy, bestfitdec, none]",
+	       warm_start,
+	       false);
+  ap.refOption("decompose",
+	       "Embed independent components of the pipeline separately, in parallel",
+	       decompose,
+	       false);
+  ap.refOption("generate",
+	       "Generate the instance in memory instead of reading infile, e.g. "
+	       "'mgw:u=2,b=2,B=1,c=5,C=25,l=0' or 'layered:n=1000,L=10,f=100,k=0,c=16'",
+	       gen_spec,
+	       false);
+  ap.refOption("savesnapshot",
+	       "Save the instance as a binary snapshot and exit; snapshots can "
+	       "be passed as infile",
+	       snapshot_file,
+	       false);
+  ap.refOption("mapping",
+	       "Re-embed the given mapping file after CPU failures, moving as few modules as possible",
+	       prev_mapping_file,
+	       false);
+  ap.refOption("failed",
+	       "Comma separated list of failed or removed CPU ids (with -mapping)",
+	       failed_cpus,
+	       false);
+  ap.refOption("migrations",
+	       "Number of modules on surviving CPUs that may be migrated (with -mapping)",
+	       migrations,
+	       false);
+  ap.refOption("savemapping",
+	       "Save the resulting mapping to a file",
+	       mapping_file,
+	       false);
+  ap.refOption("topology",
+	       "CPU topology (SMT siblings, NUMA nodes, sockets) as saved by 'lscpu -p'; "
+	       "CPU i of the instance is CPU i of the dump",
+	       topology_file,
+	       false);
+  ap.refOption("serve",
+	       "Keep the instance loaded and serve embedding requests on a Unix socket, "
+	       "or on stdin/stdout if '-'",
+	       serve,
+	       false);
+  ap.refOption("batch",
+	       "Embed every input of a list file (one path per line) or of a "
+	       "directory (.lgf and .snap files) with each of -methods",
+	       batch,
+	       false);
+  ap.refOption("methods",
+	       "Comma separated embedding methods of the batch (default: method)",
+	       batch_methods,
+	       false);
+  ap.refOption("batchout",
+	       "File the batch results are streamed to, one JSON record per line "
+	       "(default: stdout)",
+	       batch_out,
+	       false);
+  ap.refOption("cores",
+	       "Cores shared by the batch jobs; ILP jobs take -threads cores, or "
+	       "all of them (default: all cores)",
+	       batch_cores,
+	       false);
+  ap.refOption("format",
+	       "Output format of the results. [org, json]",
+	       format,
+	       false);
+  ap.refOption("quiet",
+	       "Only print the mapping and the summary statistics",
+	       quiet,
+	       false);
+  ap.refOption("metrics",
+	       "Report per-phase wall time, peak memory and algorithm counters",
+	       show_metrics,
+	       false);
   ap.synonym("i", "infile");
   ap.synonym("s", "showlog");
   ap.synonym("M", "maxflow");
   ap.synonym("m", "method");
+  ap.synonym("r", "refine");
+  ap.synonym("q", "quiet");
   ap.parse();
 
-  SmartDigraph dfg;
-  SmartDigraph::NodeMap<std::string> module_name(dfg);
-  SmartDigraph::NodeMap<float> module_weight(dfg);
-  std::map<std::string, Module> module_lookup_map;
-  std::vector<Module> modules;
-
-  size_t cpu_number;
-  float cpu_capacity;
-  std::vector<Cpu> cpus;
-
-  std::map<std::string, std::string> flow_sections;
-  std::vector<Flow> flows;
-
-  bool has_conflicts = true;
-  std::vector<std::pair<std::string, std::string>> conflict_sections;
-  SmartGraph cg;
+  // the report may hold a line per module and flow
+  std::ios::sync_with_stdio(false);
 
-  // read LGF file
-  try {
-    digraphReader(dfg, in_file).
-      nodeMap("weight", module_weight).
-      nodeMap("name", module_name).
-      attribute("cpu_number", cpu_number).
-      attribute("cpu_capacity", cpu_capacity).
-      run();
-
-    sectionReader(in_file).
-      sectionLines("flows", FlowSection(flow_sections)).
-      run();
-
-  } catch (Exception& error) {
-    std::cerr << "Error: " << error.what() << std::endl;
-    return -1;
-  }
+  if (ap.given("seed") == false)
+    seed = std::random_device()();
 
-  try {
-      sectionReader(in_file).
-	sectionLines("conflicts", ConflictSection(conflict_sections)).
-	run();
-  } catch (Exception& error) {
-    has_conflicts = false;
-  }
+  // convert method name to lowercase
+  for (auto& c : method)
+    c = std::tolower(c);
 
-  // init modules
-  // construct module lookup map to get module by name
-  for (SmartDigraph::NodeIt n(dfg); n != INVALID; ++n)
+  EmbedOptions opts;
+  opts.method = method;
+  opts.max_obj_func = max_obj_func;
+  opts.show_solver_log = show_solver_log;
+  opts.starts = starts;
+  opts.threads = threads;
+  opts.seed = seed;
+  opts.time_limit = time_limit;
+  opts.mip_gap = mip_gap;
+  opts.warm_start = warm_start;
+  opts.refine = refine;
+  opts.refine_iters = refine_iters;
+  opts.refine_time = refine_time;
+  opts.decompose = decompose;
+
+  ReportOptions report_opts;
+  report_opts.format = format;
+  report_opts.quiet = quiet;
+  report_opts.metrics = show_metrics;
+  if (show_metrics == true)
+    metrics().enable();
+  if (format != "org" && format != "json")
     {
-      Module mod = Module(n, module_name[n], module_weight[n]);
-      module_lookup_map[module_name[n]] = mod;
-      modules.push_back(mod);
+      std::cerr << "Error: invalid output format '" << format << "'" << std::endl;
+      return -1;
     }
 
-  if (has_conflicts == true)
+  // the ilp solver parameters need a MIP backend with native parameters
+  std::vector<std::string> ilp_methods = split_string_to_vec(batch_methods);
+  bool uses_ilp = (method == "ilp" || serve.empty() == false ||
+		   std::find(ilp_methods.begin(), ilp_methods.end(), "ilp") != ilp_methods.end());
+  if (uses_ilp == true && ilp_solver_params_supported() == false)
     {
-      // init conflict graph
-      for (SmartDigraph::NodeIt n(dfg); n != INVALID; ++n)
-	  cg.addNode();
-      for (const auto& it : conflict_sections)
-          cg.addEdge(cg.nodeFromId(std::stoi(it.first)),
-		     cg.nodeFromId(std::stoi(it.second)));
+      if (time_limit > 0)
+	{
+	  std::cerr << "Error: -timelimit is not supported by the MIP backend" << std::endl;
+	  return -1;
+	}
+      if (mip_gap > 0 || threads > 0)
+	std::cerr << "Warning: the MIP backend solves single threaded and to optimality, "
+		  << "-threads and -mipgap only apply to the heuristics and the warm start"
+		  << std::endl;
     }
 
-  // init flows
-  for (const auto& it : flow_sections)
+  if (batch.empty() == false)
     {
-    std::vector<Module> path;
-    for (const auto& mname : split_string_to_vec(it.second))
-	path.push_back(module_lookup_map[mname]);
-    flows.push_back(Flow(it.first, path));
+      BatchOptions batch_opts;
+      batch_opts.methods = split_string_to_vec(batch_methods.empty() ? method : batch_methods);
+      batch_opts.cores = batch_cores;
+      batch_opts.topology_file = topology_file;
+      try {
+	std::vector<std::string> inputs = get_batch_inputs(batch);
+	std::ofstream out_file;
+	if (batch_out != "-")
+	  {
+	    out_file.open(batch_out);
+	    if (!out_file)
+	      throw std::runtime_error(batch_out + ": cannot open batch output");
+	  }
+	std::ostream& out = (batch_out == "-") ? std::cout : out_file;
+	size_t failed = run_batch(inputs, opts, batch_opts, out);
+	if (failed > 0)
+	  std::cerr << failed << " batch job(s) failed" << std::endl;
+      } catch (std::runtime_error& error) {
+	std::cerr << "Error: " << error.what() << std::endl;
+	return -1;
+      }
+      return 0;
     }
 
-  // init CPUs
-  for (size_t i = 0; i < cpu_number; i++)
-    {
-      cpus.push_back(Cpu(i, cpu_capacity));
-    }
+  Instance inst;
+  try {
+    MetricsPhase phase("load");
+    if (gen_spec.empty() == false)
+      generate_instance(inst, gen_spec, seed);
+    else if (is_instance_snapshot(in_file))
+      load_instance_snapshot(inst, in_file);
+    else
+      load_instance_lgf(inst, in_file);
+    if (topology_file.empty() == false)
+      load_topology(inst, topology_file);
+    if (snapshot_file.empty() == false)
+      {
+	save_instance_snapshot(inst, snapshot_file);
+	return 0;
+      }
+  } catch (std::runtime_error& error) {
+    std::cerr << "Error: " << error.what() << std::endl;
+    return -1;
+  }
+  const SmartDigraph& dfg = inst.dfg;
+  const SmartGraph& cg = inst.cg;
+  const std::vector<Module>& modules = inst.modules;
+  const std::vector<Flow>& flows = inst.flows;
+  std::vector<Cpu>& cpus = inst.cpus;
 
   // embed
   EmbeddingResult res;
 
-  // convert method name to lowercase
-  for (auto& c : method)
-    c = std::tolower(c);
-
   std::chrono::high_resolution_clock::time_point t_before = std::chrono::high_resolution_clock::now();
 
-  if (method == "ilp")
-    {
-      res = embed_ilp(dfg, cg, cpus, flows, modules, max_obj_func, show_solver_log);
-    }
-  else if (method == "greedy" || method == "g")
-    {
-      res = embed_greedy(dfg, cg, cpus, flows, modules, max_obj_func);
-    }
-  else if (method == "bestfitdec" || method == "bfd")
-    {
-      res = embed_bestfitdecreasing(dfg, cg, cpus, flows, modules, max_obj_func);
-    }
-  else if (method == "random" || method == "rnd")
+  if (serve.empty() == false)
     {
-      res = embed_random(dfg, cg, cpus, flows, modules, max_obj_func);
+      // command line options are the defaults of the requests
+      EmbedService service(inst, opts);
+      try {
+	if (serve == "-")
+	  serve_stdio(service, std::cin, std::cout);
+	else
+	  serve_unix_socket(service, serve);
+      } catch (std::runtime_error& error) {
+	std::cerr << "Error: " << error.what() << std::endl;
+	return -1;
+      }
+      return 0;
     }
-  else if (method == "roundrobin" || method == "rr")
+
+  EmbedStat embed_stat;
+  ReembedOptions reembed_opts;
+  auto t_embed = std::chrono::steady_clock::now();
+  std::vector<size_t> previous;
+  if (prev_mapping_file.empty() == false)
     {
-      res = embed_roundrobin(dfg, cg, cpus, flows, modules, max_obj_func);
+      reembed_opts.budget = migrations;
+      try {
+	for (const auto& cpu : split_string_to_vec(failed_cpus))
+	  reembed_opts.failed.push_back(std::stoul(cpu));
+      } catch (std::logic_error& error) {
+	std::cerr << "Error: invalid CPU list '" << failed_cpus << "'" << std::endl;
+	return -1;
+      }
+      try {
+	previous = read_mapping(prev_mapping_file, dfg, modules, cpus.size());
+      } catch (std::runtime_error& error) {
+	std::cerr << "Error: " << error.what() << std::endl;
+	return -1;
+      }
     }
-  else
-    throw runtime_error("Invalid method");
+  try {
+    if (prev_mapping_file.empty() == false)
+      res = reembed_with_method(dfg, cg, cpus, flows, modules, previous, opts,
+				reembed_opts, &embed_stat);
+    else
+      res = embed_with_method(dfg, cg, cpus, flows, modules, opts, &embed_stat);
+  } catch (std::runtime_error& error) {
+    std::cerr << "Error: " << error.what() << std::endl;
+    return -1;
+  }
 
   std::chrono::high_resolution_clock::time_point t_after = std::chrono::high_resolution_clock::now();
+  metrics().add_phase("embed", elapsed_us(t_embed));
+  auto t_verify = std::chrono::steady_clock::now();
   auto embed_duration = std::chrono::duration_cast<std::chrono::microseconds>(t_after-t_before).count();
 
-  for (const auto& it : res.mapping)
-    {
-      Module& mod = module_lookup_map[module_name[dfg.nodeFromId(it.first)]];
-      cpus[it.second].add_module(mod);
-    }
-
-  // verificate results
-  for (const auto& it : conflict_sections)
-    {
-      int u = std::stoi(it.first);
-      int v = std::stoi(it.second);
-      if (res.mapping.at(u) == res.mapping.at(v))
-  	throw runtime_error("Invalid mapping!");
-    }
-
-  // print results
-  std::cout << std::endl << "* Modules" << std::endl;
+  // modules indexed by node id
+  std::vector<const Module*> module_by_id(countNodes(dfg));
   for (const auto& module : modules)
-    std::cout << module << " [" << dfg.id(module.node()) << "]" << std::endl;
-
-  std::cout  << std::endl << "* Flows" << std::endl;
-  for (const auto& f : flows)
-    std::cout << f << std::endl;
-
-  std::cout  << std::endl << "* CPUs" << std::endl;
-  for (const auto& c : cpus)
-    std::cout << c << std::endl;
+    module_by_id[dfg.id(module.node())] = &module;
 
-  std::cout  << std::endl << "* Objective function"
-	     << std::endl << "value: " << res.sol_value << std::endl;
+  for (size_t id = 0; id < res.mapping.size(); ++id)
+    cpus[res.mapping[id]].add_module(*module_by_id[id]);
 
-  // print stats
-  std::vector<FlowStat> flow_stats;
-  for (const auto& flow : flows)
-      flow_stats.push_back(FlowStat(flow, res, dfg));
-
-  std::cout  << std::endl << "* Flow stats" << std::endl;
+  for (const auto& cpu : cpus)
+    if (cpu.load() > cpu.capacity() * (1 + 1e-6f))
+      throw runtime_error("Invalid mapping!");
 
-  std::vector<size_t> flow_crossings;
-  std::vector<size_t> flow_cpus;
-  for (const auto& fs : flow_stats)
+  // verificate results
+  for (SmartGraph::EdgeIt e(cg); e != INVALID; ++e)
     {
-      flow_crossings.push_back(fs.crossings);
-      flow_cpus.push_back(fs.cpus);
-      std::cout << fs << std::endl;
+      int u = cg.id(cg.u(e));
+      int v = cg.id(cg.v(e));
+      if (res.mapping.at(u) == res.mapping.at(v))
+  	throw runtime_error("Invalid mapping!");
     }
-  float sum_flow_crossings = std::accumulate(flow_crossings.begin(), flow_crossings.end(), 0.0);
-  float sum_flow_cpus = std::accumulate(flow_cpus.begin(), flow_cpus.end(), 0.0);
 
-  std::cout << std::endl << "** cpus" << std::endl
-	    << "sum: " <<  sum_flow_cpus << std::endl
-    	    << "min: " << *std::min_element(flow_cpus.begin(), flow_cpus.end()) << std::endl
-	    << "max: " << *std::max_element(flow_cpus.begin(), flow_cpus.end()) << std::endl
-	    << "avg: " << sum_flow_cpus / flow_stats.size() << std::endl
-	    << "std_dev: " << calc_stdev<size_t>(flow_cpus, sum_flow_cpus) << std::endl
-	    << std::endl;
+  metrics().add_phase("verify", elapsed_us(t_verify));
 
-  std::cout << "** crossings" << std::endl
-	    << "sum: " <<  sum_flow_crossings << std::endl
-    	    << "min: " << *std::min_element(flow_crossings.begin(), flow_crossings.end()) << std::endl
-	    << "max: " << *std::max_element(flow_crossings.begin(), flow_crossings.end()) << std::endl
-	    << "avg: " <<  sum_flow_crossings / flow_stats.size() << std::endl
-	    << "std_dev: " << calc_stdev<size_t>(flow_crossings, sum_flow_crossings) << std::endl
-	    << std::endl;
+  if (mapping_file.empty() == false)
+    write_mapping(mapping_file, dfg, modules, res.mapping);
 
-
-  std::cout  << std::endl << "* CPU stats" << std::endl;
-
-  std::vector<float> cpu_loads;
-  for (const auto& cpu : cpus)
-      cpu_loads.push_back(cpu.load());
-  float sum_cpu_loads = std::accumulate(cpu_loads.begin(), cpu_loads.end(), 0.0);
-
-  std::cout << std::endl << "** load" << std::endl
-    	    << "available: " <<  cpus[0].capacity() * cpus.size() << std::endl
-	    << "sum: " <<  sum_cpu_loads << std::endl
-    	    << "min: " << *std::min_element(cpu_loads.begin(), cpu_loads.end()) << std::endl
-	    << "max: " << *std::max_element(cpu_loads.begin(), cpu_loads.end()) << std::endl
-	    << "avg: " <<  sum_cpu_loads / cpus.size() << std::endl
-    	    << "std_dev: " <<  calc_stdev<float>(cpu_loads, sum_cpu_loads) << std::endl
-	    << std::endl;
-
-  std::cout << "* Execution time" << std::endl
-	    << embed_duration << " us" << std::endl << std::endl;
+  // print results
+  try {
+    print_report(std::cout, inst, res, embed_stat, opts,
+		 prev_mapping_file.empty() ? nullptr : &reembed_opts,
+		 embed_duration, report_opts);
+  } catch (std::runtime_error& error) {
+    std::cerr << "Error: " << error.what() << std::endl;
+    return -1;
+  }
 
   return 0;
 }
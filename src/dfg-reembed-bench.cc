@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// re-embedding benchmark, run by make reembed-bench: every surviving cpu
+// is nearly full of light modules and the failed one hosts heavy modules
+// that fit nowhere, so each of them needs a migration to make room; the
+// repair heuristic is timed without its improvement phase
+//
+//   dfg-reembed-bench [modules [cpus [heavy [flows]]]]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "embed.h"
+#include "embed-common.h"
+#include "generate.h"
+#include "instance.h"
+
+using namespace lemon;
+
+
+int main(int argc, char** argv)
+{
+  const int module_number = argc > 1 ? std::atoi(argv[1]) : 50000;
+  const int cpu_number = argc > 2 ? std::atoi(argv[2]) : 64;
+  const int heavy = argc > 3 ? std::atoi(argv[3]) : 20;
+  const int flow_number = argc > 4 ? std::atoi(argv[4]) : module_number / 10;
+  if (cpu_number < 2 || heavy < 0 || 2 * heavy > cpu_number - 1 ||
+      flow_number < 0 || module_number < heavy + cpu_number - 1)
+    {
+      std::cerr << "usage: " << argv[0] << " [modules [cpus [heavy [flows]]]]"
+		<< std::endl;
+      return 1;
+    }
+
+  // light modules of weight 1 leave 11 units free on the surviving cpus,
+  // the heavy ones of weight 12 are on cpu 0
+  Instance inst;
+  _InstanceBuilder b(inst);
+  const int light = (module_number - heavy) / (cpu_number - 1);
+  const float capacity = std::max(float(light + 11), float(12 * heavy));
+  std::vector<size_t> mapping;
+  for (int cpu = 1; cpu < cpu_number; ++cpu)
+    for (int k = 0; k < light; ++k)
+      {
+	b.add_module("m" + std::to_string(mapping.size()), 1);
+	mapping.push_back(cpu);
+      }
+  for (int k = 0; k < heavy; ++k)
+    {
+      b.add_module("m" + std::to_string(mapping.size()), 12);
+      mapping.push_back(0);
+    }
+  std::default_random_engine generator(1);
+  std::uniform_int_distribution<int> rnd_module(0, mapping.size() - 1);
+  for (int f = 0; f < flow_number; ++f)
+    {
+      std::vector<int> path;
+      for (int i = 0; i < 10; ++i)
+	path.push_back(rnd_module(generator));
+      std::sort(path.begin(), path.end());
+      path.erase(std::unique(path.begin(), path.end()), path.end());
+      b.add_flow("f" + std::to_string(f), path);
+    }
+  b.finish(cpu_number, capacity, 0);
+
+  ReembedOptions opts;
+  opts.failed = {0};
+  opts.budget = heavy;
+  opts.time_limit_ms = 0;
+  ReembedStat st;
+  auto start = std::chrono::steady_clock::now();
+  try {
+    EmbeddingResult res = repair_embedding(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					   inst.modules, mapping, false, opts, &st);
+    double ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+    std::cout << "modules: " << mapping.size() << std::endl
+	      << "cpus: " << cpu_number << std::endl
+	      << "displaced: " << st.displaced << std::endl
+	      << "migrated: " << st.migrated << std::endl
+	      << "value: " << res.sol_value << " (previous " << st.previous_value << ")"
+	      << std::endl
+	      << "repair: " << ms << " ms" << std::endl;
+  } catch (std::runtime_error& error) {
+    std::cerr << "Error: " << error.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The interface of dfgembed.h, in libdfgembed next to the embedding
+// dispatch of embed.cc: the dfg-embed headers define their (inline)
+// functions, which are compiled here behind that interface.
+
+#include "dfgembed.h"
+
+#include <cctype>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "embed.h"
+#include "flow.h"
+#include "generate.h"
+#include "instance.h"
+#include "lgf-loader.h"
+#include "module.h"
+#include "snapshot.h"
+
+using namespace lemon;
+
+namespace dfgembed {
+
+
+struct Instance::Impl
+{
+  ::Instance inst;
+  std::vector<std::string> names;  // by node id
+  std::vector<size_t> positions;  // in inst.modules, by node id
+  std::unordered_map<std::string, size_t> node_by_name;
+
+  void index_modules()
+  {
+    // after loading: module indices are the node ids
+    names.assign(countNodes(inst.dfg), std::string());
+    positions.assign(names.size(), 0);
+    node_by_name.clear();
+    for (size_t i = 0; i < inst.modules.size(); ++i)
+      {
+	size_t id = inst.dfg.id(inst.modules[i].node());
+	names[id] = inst.modules[i].name();
+	positions[id] = i;
+	node_by_name[names[id]] = id;
+      }
+  }
+
+  void check_module(size_t v) const
+  {
+    if (v >= names.size())
+      throw std::out_of_range("module index " + std::to_string(v) + " out of range");
+  }
+
+  void check_cpu(size_t cpu) const
+  {
+    if (cpu >= inst.cpus.size())
+      throw std::out_of_range("cpu index " + std::to_string(cpu) + " out of range");
+  }
+
+  const Module& module(size_t v) const
+  {
+    // modules by node id, with their current weights
+    check_module(v);
+    return inst.modules[positions[v]];
+  }
+};
+
+
+Instance::Instance() : impl_(new Impl()) {}
+Instance::~Instance() {}
+Instance::Instance(Instance&&) noexcept = default;
+Instance& Instance::operator=(Instance&&) noexcept = default;
+
+
+Instance Instance::load(const std::string& file)
+{
+  Instance retval;
+  if (is_instance_snapshot(file))
+    load_instance_snapshot(retval.impl_->inst, file);
+  else
+    load_instance_lgf(retval.impl_->inst, file);
+  retval.impl_->index_modules();
+  return retval;
+}
+
+
+Instance Instance::generate(const std::string& spec, unsigned seed)
+{
+  Instance retval;
+  generate_instance(retval.impl_->inst, spec, seed);
+  retval.impl_->index_modules();
+  return retval;
+}
+
+
+size_t Instance::add_module(const std::string& name, float weight)
+{
+  ::Instance& inst = impl_->inst;
+  if (impl_->node_by_name.count(name) > 0)
+    throw std::invalid_argument("duplicate module name '" + name + "'");
+  SmartDigraph::Node n = inst.dfg.addNode();
+  // the conflict graph has a node per module once it has a conflict
+  if (countNodes(inst.cg) > 0)
+    inst.cg.addNode();
+  inst.modules.push_back(Module(n, name, weight));
+  size_t id = inst.dfg.id(n);
+  impl_->names.push_back(name);
+  impl_->positions.push_back(inst.modules.size() - 1);
+  impl_->node_by_name[name] = id;
+  return id;
+}
+
+
+void Instance::add_arc(size_t from, size_t to)
+{
+  ::Instance& inst = impl_->inst;
+  impl_->check_module(from);
+  impl_->check_module(to);
+  inst.dfg.addArc(inst.dfg.nodeFromId(from), inst.dfg.nodeFromId(to));
+}
+
+
+void Instance::add_conflict(size_t u, size_t v)
+{
+  ::Instance& inst = impl_->inst;
+  impl_->check_module(u);
+  impl_->check_module(v);
+  if (u == v)
+    throw std::invalid_argument("module " + std::to_string(u) + " conflicts with itself");
+  while ((size_t) countNodes(inst.cg) < impl_->names.size())
+    inst.cg.addNode();
+  inst.cg.addEdge(inst.cg.nodeFromId(u), inst.cg.nodeFromId(v));
+}
+
+
+void Instance::add_flow(const std::string& name, const std::vector<size_t>& modules,
+			long rate)
+{
+  ::Instance& inst = impl_->inst;
+  if (modules.empty())
+    throw std::invalid_argument("flow '" + name + "' has no modules");
+  if (rate < 0)
+    throw std::invalid_argument("flow '" + name + "' has a negative rate");
+  std::vector<Module> path;
+  for (size_t k = 0; k < modules.size(); ++k)
+    {
+      path.push_back(impl_->module(modules[k]));
+      if (k == 0)
+	continue;
+      // the ilp looks up the arc of every step of a flow
+      SmartDigraph::Node u = inst.dfg.nodeFromId(modules[k-1]);
+      SmartDigraph::Node v = inst.dfg.nodeFromId(modules[k]);
+      bool found = false;
+      for (SmartDigraph::OutArcIt a(inst.dfg, u); a != INVALID && found == false; ++a)
+	found = (inst.dfg.target(a) == v);
+      if (found == false)
+	throw std::invalid_argument("flow '" + name + "': no arc from module " +
+				    std::to_string(modules[k-1]) + " to " +
+				    std::to_string(modules[k]));
+    }
+  inst.flows.push_back(Flow(name, path, rate));
+}
+
+
+size_t Instance::add_cpu(float capacity)
+{
+  ::Instance& inst = impl_->inst;
+  if (get_topology(inst.cpus) != nullptr)
+    throw std::logic_error("cpus cannot be added after the topology");
+  if (capacity < 0)
+    throw std::invalid_argument("negative cpu capacity");
+  inst.cpus.push_back(Cpu(inst.cpus.size(), capacity));
+  return inst.cpus.size() - 1;
+}
+
+
+void Instance::load_topology(const std::string& lscpu_file)
+{
+  ::load_topology(impl_->inst, lscpu_file);
+}
+
+
+void Instance::set_module_weights(const std::vector<float>& weights)
+{
+  if (weights.size() != impl_->names.size())
+    throw std::invalid_argument("expected " + std::to_string(impl_->names.size()) +
+				" module weights");
+  update_module_weights(impl_->inst, weights);
+}
+
+
+size_t Instance::modules() const { return impl_->names.size(); }
+size_t Instance::flows() const { return impl_->inst.flows.size(); }
+size_t Instance::cpus() const { return impl_->inst.cpus.size(); }
+
+const std::string& Instance::module_name(size_t module) const
+{
+  impl_->check_module(module);
+  return impl_->names[module];
+}
+
+size_t Instance::module_index(const std::string& name) const
+{
+  auto it = impl_->node_by_name.find(name);
+  if (it == impl_->node_by_name.end())
+    throw std::invalid_argument("unknown module '" + name + "'");
+  return it->second;
+}
+
+
+static EmbedOptions _embed_options(const Options& opts)
+{
+  EmbedOptions retval;
+  retval.method = opts.method;
+  for (auto& c : retval.method)
+    c = std::tolower(c);
+  retval.max_obj_func = opts.max_flow;
+  retval.show_solver_log = false;
+  retval.starts = opts.starts;
+  retval.threads = opts.threads;
+  retval.seed = opts.seed;
+  retval.time_limit = opts.time_limit;
+  retval.mip_gap = opts.mip_gap;
+  retval.warm_start = opts.warm_start;
+  retval.refine = opts.refine;
+  retval.refine_iters = opts.refine_iters;
+  retval.refine_time = opts.refine_time;
+  retval.decompose = opts.decompose;
+  return retval;
+}
+
+
+static void _check_instance(const ::Instance& inst)
+{
+  if (inst.modules.empty())
+    throw std::invalid_argument("instance has no modules");
+  if (inst.cpus.empty())
+    throw std::invalid_argument("instance has no cpus");
+}
+
+
+Result embed(const Instance& instance, const Options& opts)
+{
+  const ::Instance& inst = instance.impl_->inst;
+  _check_instance(inst);
+  auto t_before = std::chrono::steady_clock::now();
+  EmbeddingResult res = embed_with_method(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					  inst.modules, _embed_options(opts));
+  Result retval;
+  retval.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - t_before).count();
+  retval.mapping = res.mapping;
+  retval.value = res.sol_value;
+  retval.gap = res.gap;
+  return retval;
+}
+
+
+Result reembed(const Instance& instance,
+	       const std::vector<size_t>& previous,
+	       const std::vector<size_t>& failed,
+	       long migrations,
+	       const Options& opts)
+{
+  const ::Instance& inst = instance.impl_->inst;
+  _check_instance(inst);
+  if (previous.size() != instance.modules())
+    throw std::invalid_argument("expected the cpu of " + std::to_string(instance.modules()) +
+				" modules");
+  for (size_t cpu : previous)
+    instance.impl_->check_cpu(cpu);
+  for (size_t cpu : failed)
+    instance.impl_->check_cpu(cpu);
+
+  ReembedOptions reembed_opts;
+  reembed_opts.failed = failed;
+  reembed_opts.budget = migrations;
+  EmbedStat stat;
+  auto t_before = std::chrono::steady_clock::now();
+  EmbeddingResult res = reembed_with_method(inst.dfg, inst.cg, inst.cpus, inst.flows,
+					    inst.modules, previous, _embed_options(opts),
+					    reembed_opts, &stat);
+  Result retval;
+  retval.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - t_before).count();
+  retval.mapping = res.mapping;
+  retval.value = res.sol_value;
+  retval.gap = res.gap;
+  retval.displaced = stat.reembed.displaced;
+  retval.migrated = stat.reembed.migrated;
+  return retval;
+}
+
+
+}  // namespace dfgembed
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DFGEMBED_H
+#define DFGEMBED_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// libdfgembed: the embedding methods of dfg-embed as a library. This is
+// the only header of the library; it does not depend on LEMON or on the
+// other headers of dfg-embed, which are compiled into the library (in
+// dfgembed.cc and embed.cc) once.
+//
+// embed() and reembed() are reentrant: they may run concurrently, on the
+// same instance or on different ones, as long as no thread modifies an
+// instance while it is embedded. Concurrent ILP solves also need a
+// thread-safe MIP backend. The only state they share is the metrics of
+// the process (see metrics.h), which the library never enables and whose
+// records are synchronized. Errors are reported by exceptions.
+
+#define DFGEMBED_API __attribute__((visibility("default")))
+
+namespace dfgembed {
+
+
+struct DFGEMBED_API Options
+{
+  // embedding method and its parameters, see the dfg-embed options
+  // ilp, greedy, bestfitdec, random, roundrobin; reembed() also takes repair
+  std::string method = "ilp";
+  bool max_flow = false;  // minimize the max crossings of a flow
+  int starts = 1;
+  int threads = 0;
+  unsigned seed = 0;
+  double time_limit = 0;  // [s], rejected if the MIP backend has no time limit
+  double mip_gap = 0;
+  std::string warm_start = "greedy";
+  bool refine = false;
+  int refine_iters = 1000000;
+  int refine_time = 100;  // [ms]
+  bool decompose = false;
+};
+
+
+struct DFGEMBED_API Result
+{
+  std::vector<size_t> mapping;  // cpu of each module, by module index
+  long value = 0;  // objective value
+  double gap = -1;  // relative gap to a lower bound, -1: not known
+  long time_us = 0;
+  // re-embedding: modules of failed cpus, and modules moved off a
+  // surviving cpu
+  size_t displaced = 0;
+  size_t migrated = 0;
+};
+
+
+class DFGEMBED_API Instance
+{
+  // modules (indexed from 0 in the order they were added or loaded),
+  // the arcs and conflicts between them, flows and cpus
+ public:
+  Instance();
+  ~Instance();
+  Instance(Instance&&) noexcept;
+  Instance& operator=(Instance&&) noexcept;
+  Instance(const Instance&) = delete;
+  Instance& operator=(const Instance&) = delete;
+
+  // an LGF file or binary snapshot, or a generator spec of -generate
+  static Instance load(const std::string& file);
+  static Instance generate(const std::string& spec, unsigned seed = 0);
+
+  // building an instance: flows can only use existing arcs, and cpus
+  // cannot be added after the topology is set
+  size_t add_module(const std::string& name, float weight);
+  void add_arc(size_t from, size_t to);
+  void add_conflict(size_t u, size_t v);
+  void add_flow(const std::string& name, const std::vector<size_t>& modules,
+		long rate = 1);
+  size_t add_cpu(float capacity);
+  void load_topology(const std::string& lscpu_file);
+  void set_module_weights(const std::vector<float>& weights);
+
+  size_t modules() const;
+  size_t flows() const;
+  size_t cpus() const;
+  const std::string& module_name(size_t module) const;
+  size_t module_index(const std::string& name) const;
+
+ private:
+  friend DFGEMBED_API Result embed(const Instance& inst, const Options& opts);
+  friend DFGEMBED_API Result reembed(const Instance& inst,
+				     const std::vector<size_t>& previous,
+				     const std::vector<size_t>& failed,
+				     long migrations,
+				     const Options& opts);
+
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+
+// embeds the instance with the given method
+DFGEMBED_API Result embed(const Instance& inst, const Options& opts = Options());
+
+// re-embeds a previous mapping after the failure (or removal) of cpus,
+// moving the modules of the failed cpus and, with the repair and ilp
+// methods, at most migrations others
+DFGEMBED_API Result reembed(const Instance& inst,
+			    const std::vector<size_t>& previous,
+			    const std::vector<size_t>& failed,
+			    long migrations = 0,
+			    const Options& opts = Options());
+
+
+}  // namespace dfgembed
+
+#endif  // DFGEMBED_H
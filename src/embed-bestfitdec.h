@@ -18,11 +18,15 @@
 #ifndef EMBED_BESTFITDEC_H
 #define EMBED_BESTFITDEC_H
 
+#include <cstdint>
+#include <random>
+#include <set>
 #include <vector>
 #include <stdexcept>
 #include <lemon/smart_graph.h>
 
 #include "embed-common.h"
+#include "metrics.h"
 
 
 using namespace lemon;
@@ -33,150 +37,207 @@ struct CpuBin
 {
   size_t cpu_id;
   float free_cap;
-  CpuBin(const size_t& id, float free_capacity)
+  uint64_t stamp;  // orders bins of equal free capacity, then the cpu id
+  CpuBin(const size_t& id, float free_capacity, uint64_t stamp_ = 0)
   {
     cpu_id = id;
     free_cap = free_capacity;
+    stamp = stamp_;
   }
 };
 
-bool compare_cpubin_cap_decr(const CpuBin a, const CpuBin b)
+inline bool compare_cpubin_cap_decr(const CpuBin a, const CpuBin b)
 {
-  return (b.free_cap > a.free_cap);
+  // the cpu id keeps bins with colliding (random) stamps apart in the set
+  return (b.free_cap > a.free_cap ||
+	  (b.free_cap == a.free_cap &&
+	   (b.stamp > a.stamp || (b.stamp == a.stamp && b.cpu_id > a.cpu_id))));
 }
 
-bool compare_module_weight_decr(const Module* m, const Module* n)
+inline bool compare_module_weight_decr(const Module* m, const Module* n)
 {
   return (m->weight() > n->weight());
 }
 
 
-EmbeddingResult _embed_bfd_conflictfree(const SmartDigraph& g,
-					const SmartGraph& cg,
-					const std::vector<Cpu>& cpus,
-					const std::vector<Flow>& flows,
-					const std::vector<Module>& modules,
-					bool max_obj_func = false)
+inline std::vector<const Module*> _bfd_sort_modules(const std::vector<Module>& modules,
+						    std::default_random_engine* generator)
+{
+  // order modules by decreasing weight, equal weights in random order
+  // if a generator is given
+  std::vector<const Module*> modules_sorted;
+  for (const auto& module : modules)
+    modules_sorted.push_back(&module);
+  if (generator == nullptr)
+    std::sort(modules_sorted.begin(), modules_sorted.end(), compare_module_weight_decr);
+  else
+    {
+      std::shuffle(modules_sorted.begin(), modules_sorted.end(), *generator);
+      std::stable_sort(modules_sorted.begin(), modules_sorted.end(),
+		       compare_module_weight_decr);
+    }
+  return modules_sorted;
+}
+
+
+class CpuBins
+{
+  // cpu bins ordered by increasing free capacity, so the tightest bin a
+  // module fits in is found in O(log m); among bins of equal free
+  // capacity the one that got there first comes first (as repeatedly
+  // insertion sorting the bins would do), or a random one if a generator
+  // is given
+ public:
+  CpuBins(const std::vector<Cpu>& cpus, std::default_random_engine* generator)
+    : bins_(compare_cpubin_cap_decr), generator_(generator)
+    {
+      for (const auto& cpu : cpus)
+	{
+	  CpuBin bin(cpu.id(), cpu.capacity() - cpu.load(), next_stamp());
+	  bins_.insert(bin);
+	  slots_.push_back(bin);
+	}
+    }
+
+  template <typename Eligible>
+  size_t best_fit(float weight, Eligible eligible) const
+  {
+    // id of the tightest eligible bin that still fits weight, or UNMAPPED
+    for (auto it = bins_.lower_bound(CpuBin(0, weight, 0));
+	 it != bins_.end(); ++it)
+      {
+	++scanned_;
+	if (eligible(it->cpu_id))
+	  return it->cpu_id;
+      }
+    return UNMAPPED;
+  }
+
+  size_t best_fit(float weight) const
+  {
+    return best_fit(weight, [](size_t) { return true; });
+  }
+
+  // number of bins looked at so far, for the metrics
+  size_t scanned() const { return scanned_; }
+
+  void take(size_t cpu_id, float weight)
+  {
+    if (weight == 0)
+      return;
+    CpuBin& bin = slots_[cpu_id];
+    bins_.erase(bin);
+    bin.free_cap -= weight;
+    bin.stamp = next_stamp();
+    bins_.insert(bin);
+  }
+
+ private:
+  uint64_t next_stamp()
+  {
+    return generator_ == nullptr ? stamp_++ : (*generator_)();
+  }
+
+  std::set<CpuBin, bool (*)(const CpuBin, const CpuBin)> bins_;
+  std::vector<CpuBin> slots_;  // current key of each bin, by cpu id
+  std::default_random_engine* generator_;
+  uint64_t stamp_ = 0;
+  mutable size_t scanned_ = 0;
+};
+
+
+inline EmbeddingResult _embed_bfd_conflictfree(const SmartDigraph& g,
+					       const SmartGraph& cg,
+					       const std::vector<Cpu>& cpus,
+					       const std::vector<Flow>& flows,
+					       const std::vector<Module>& modules,
+					       bool max_obj_func = false,
+					       std::default_random_engine* generator = nullptr)
 {
   EmbeddingResult retval;
+  retval.mapping.assign(countNodes(g), UNMAPPED);
 
   // init bins (with size of free cpu capacities)
-  std::vector<CpuBin> bins;
-  for (const auto& cpu : cpus)
-    bins.push_back(CpuBin(cpu.id(), cpu.capacity() - cpu.load()));
+  CpuBins bins(cpus, generator);
 
   // sort modules
-  std::vector<const Module*> modules_sorted;
-  for (const auto& module : modules)
-    modules_sorted.push_back(&module);
-  std::sort(modules_sorted.begin(), modules_sorted.end(), compare_module_weight_decr);
+  std::vector<const Module*> modules_sorted = _bfd_sort_modules(modules, generator);
 
   for (const auto& module_ptr : modules_sorted)
     {
       const Module& module = *module_ptr;
-      size_t idx = -1;
-
-      std::sort(bins.begin(), bins.end(), compare_cpubin_cap_decr);
-      for (auto& bin : bins)
-	{
-	  float val = bin.free_cap - module.weight();
-	  if (val >= 0)
-	    {
-	      idx = bin.cpu_id;
-	      bin.free_cap = val;
-	      break;
-	    }
-	}
+      size_t idx = bins.best_fit(module.weight());
       if (idx > cpus.size())
-	throw std::runtime_error("Embedding not possible: out of available CPUs");
+	throw EmbeddingInfeasible("Embedding not possible: out of available CPUs");
+      bins.take(idx, module.weight());
 
       retval.mapping[g.id(module.node())] = idx;
     }
+  metrics().add("bins_scanned", bins.scanned());
 
-  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func);
+  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func,
+					get_topology(cpus));
   return retval;
 }
 
 
-EmbeddingResult _embed_bfd_conflicts(const SmartDigraph& g,
-				     const SmartGraph& cg,
-				     const std::vector<Cpu>& cpus,
-				     const std::vector<Flow>& flows,
-				     const std::vector<Module>& modules,
-				     bool max_obj_func = false)
+inline EmbeddingResult _embed_bfd_conflicts(const SmartDigraph& g,
+					    const SmartGraph& cg,
+					    const std::vector<Cpu>& cpus,
+					    const std::vector<Flow>& flows,
+					    const std::vector<Module>& modules,
+					    bool max_obj_func = false,
+					    std::default_random_engine* generator = nullptr)
 {
   EmbeddingResult retval;
+  retval.mapping.assign(countNodes(g), UNMAPPED);
 
   // init bins (with size of free cpu capacities)
-  std::vector<CpuBin> bins;
-  for (const auto& cpu : cpus)
-    bins.push_back(CpuBin(cpu.id(), cpu.capacity() - cpu.load()));
+  CpuBins bins(cpus, generator);
+
+  ConflictCliques cliques = get_conflict_cliques(g, cg);
+  CpuConflictMask conflict_mask(cliques, g, cpus);
 
   // sort modules
-  std::vector<const Module*> modules_sorted;
-  for (const auto& module : modules)
-    modules_sorted.push_back(&module);
-  std::sort(modules_sorted.begin(), modules_sorted.end(), compare_module_weight_decr);
+  std::vector<const Module*> modules_sorted = _bfd_sort_modules(modules, generator);
 
   for (const auto& module_ptr : modules_sorted)
     {
       const Module& module = *module_ptr;
-      std::set<int> conflict_ids = get_conflict_ids(module, g, cg);
-      size_t idx = -1;
+      const size_t v = g.id(module.node());
 
-      std::sort(bins.begin(), bins.end(), compare_cpubin_cap_decr);
-      for (auto& bin : bins)
-	{
-	  // check cpu eligability
-	  bool no_go = false;
-	  for (const auto& c : conflict_ids)
-	    if (retval.mapping[c] == cpus[bin.cpu_id].id())
-	      {
-		no_go = true;
-		break;
-	      }
-	  if (no_go == false)
-	    for (const auto& cpu_module : cpus[bin.cpu_id].modules())
-	      if (conflict_ids.find(g.id(cpu_module.node())) != conflict_ids.end())
-		{
-		  no_go = true;
-		  break;
-		}
-
-	  if (no_go == true)
-	    // if cpu is  not eligable, try next one
-	    continue;
-
-	  float val = bin.free_cap - module.weight();
-	  if (val >= 0)
-	    {
-	      idx = bin.cpu_id;
-	      bin.free_cap = val;
-	      break;
-	    }
-	}
+      // tightest bin among the eligible ones
+      size_t idx = bins.best_fit(module.weight(), [&](size_t cpu_id) {
+	  return conflict_mask.blocked(v, cpu_id) == false;
+	});
       if (idx > cpus.size())
-	throw std::runtime_error("Embedding not possible: out of available CPUs");
+	throw EmbeddingInfeasible("Embedding not possible: out of available CPUs");
+      bins.take(idx, module.weight());
 
-      retval.mapping[g.id(module.node())] = idx;
+      retval.mapping[v] = idx;
+      conflict_mask.place(v, idx);
     }
+  metrics().add("bins_scanned", bins.scanned());
+  metrics().add("conflict_checks", conflict_mask.checks());
 
-  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func);
+  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func,
+					get_topology(cpus));
   return retval;
 }
 
 
-EmbeddingResult embed_bestfitdecreasing(const SmartDigraph& g,
-					const SmartGraph& cg,
-					const std::vector<Cpu>& cpus,
-					const std::vector<Flow>& flows,
-					const std::vector<Module>& modules,
-					bool max_obj_func = false)
+inline EmbeddingResult embed_bestfitdecreasing(const SmartDigraph& g,
+					       const SmartGraph& cg,
+					       const std::vector<Cpu>& cpus,
+					       const std::vector<Flow>& flows,
+					       const std::vector<Module>& modules,
+					       bool max_obj_func = false,
+					       std::default_random_engine* generator = nullptr)
 {
   if (countEdges(cg) == 0)
-    return _embed_bfd_conflictfree(g, cg, cpus, flows, modules, max_obj_func);
+    return _embed_bfd_conflictfree(g, cg, cpus, flows, modules, max_obj_func, generator);
   else
-    return _embed_bfd_conflicts(g, cg, cpus, flows, modules, max_obj_func);
+    return _embed_bfd_conflicts(g, cg, cpus, flows, modules, max_obj_func, generator);
 }
 
 
@@ -20,53 +20,468 @@
 
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <lemon/smart_graph.h>
+#include <map>
 #include <numeric>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "cpu.h"
 #include "flow.h"
+#include "metrics.h"
 #include "module.h"
 
 
+const size_t UNMAPPED = -1;  // mapping value of a not (yet) embedded module
+
+
 struct EmbeddingResult
 {
   // stores embedding result
   long sol_value = 0;  // objective function's solution
-  std::map<std::size_t, std::size_t> mapping;  // node_id: cpu_num
+  double gap = -1;  // relative gap to a proven lower bound (if known)
+  std::vector<std::size_t> mapping;  // node_id -> cpu_num (dense, by node id)
+};
+
+
+class EmbeddingInfeasible : public std::runtime_error
+{
+  // the modules do not fit the cpus: thrown by the methods and the
+  // presolve, unlike solver failures and invalid options
+ public:
+  explicit EmbeddingInfeasible(const std::string& what) : std::runtime_error(what) {}
+};
+
+
+class FlowPaths
+{
+  // flows stored as compact node id arrays (CSR layout), flows of the
+  // same module path sharing one entry (flow class), numbered in the
+  // order of their first flow: class c traverses nodes[offsets[c]] ..
+  // nodes[offsets[c+1]-1], and its crossings count rate(c) times in the
+  // sum (the total rate of its flows) and peak_rate(c) times in the max
+  // objective (the largest rate of its flows)
+ public:
+  FlowPaths() {}
+  FlowPaths(const lemon::SmartDigraph& g, const std::vector<Flow>& flows)
+    {
+      std::unordered_map<uint64_t, std::vector<size_t>> classes_by_hash;
+      std::vector<int> path;
+      for (const auto& flow : flows)
+	{
+	  path.clear();
+	  uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+	  for (const auto& m : flow.modules())
+	    {
+	      path.push_back(g.id(m.node()));
+	      hash = (hash ^ (uint32_t) path.back()) * 1099511628211ULL;
+	    }
+
+	  std::vector<size_t>& candidates = classes_by_hash[hash];
+	  size_t c = 0;
+	  while (c < candidates.size() &&
+		 std::equal(path.begin(), path.end(),
+			    begin(candidates[c]), end(candidates[c])) == false)
+	    ++c;
+	  if (c == candidates.size())
+	    {
+	      candidates.push_back(size());
+	      nodes_.insert(nodes_.end(), path.begin(), path.end());
+	      offsets_.push_back(nodes_.size());
+	      rates_.push_back(0);
+	      peak_rates_.push_back(0);
+	    }
+	  c = candidates[c];
+
+	  class_of_.push_back(c);
+	  rates_[c] += flow.rate();
+	  peak_rates_[c] = std::max(peak_rates_[c], flow.rate());
+	  weighted_ = weighted_ || flow.rate() != 1;
+	}
+    }
+
+  // flow classes
+  size_t size() const { return offsets_.size() - 1; }
+  size_t length(size_t c) const { return offsets_[c+1] - offsets_[c]; }
+  const int* begin(size_t c) const { return nodes_.data() + offsets_[c]; }
+  const int* end(size_t c) const { return nodes_.data() + offsets_[c+1]; }
+  const std::vector<size_t>& offsets() const { return offsets_; }
+  const std::vector<int>& nodes() const { return nodes_; }
+  long rate(size_t c) const { return rates_[c]; }
+  long peak_rate(size_t c) const { return peak_rates_[c]; }
+
+  // flows, in the order of the flow list
+  size_t flow_num() const { return class_of_.size(); }
+  size_t flow_class(size_t f) const { return class_of_[f]; }
+  // some flow has a rate other than 1
+  bool weighted() const { return weighted_; }
+
+ private:
+  std::vector<size_t> offsets_ = {0};
+  std::vector<int> nodes_;
+  std::vector<long> rates_;
+  std::vector<long> peak_rates_;
+  std::vector<size_t> class_of_;
+  bool weighted_ = false;
 };
 
 
-long get_flow_crossings(const lemon::SmartDigraph& g,
-			const std::map<size_t, size_t>& mapping,
-			const std::vector<Flow>& flows,
-			bool max_flow_crossings)
+inline const Topology* get_topology(const std::vector<Cpu>& cpus)
+{
+  // crossing costs of the cpus, null if every crossing costs 1
+  if (cpus.empty() || cpus[0].topology() == nullptr || cpus[0].topology()->flat())
+    return nullptr;
+  return cpus[0].topology();
+}
+
+
+inline size_t get_path_crossings(const int* first, const int* last,
+				 const std::vector<size_t>& mapping,
+				 const Topology* topology = nullptr)
+{
+  // counts cpu changes along a single flow path, weighted by their
+  // topology cost
+  size_t cross_sum = 0;
+  if (topology != nullptr)
+    {
+      for (const int* it = first; it + 1 < last; ++it)
+	cross_sum += topology->cost(mapping[*it], mapping[*(it+1)]);
+      return cross_sum;
+    }
+  for (const int* it = first; it + 1 < last; ++it)
+    if (mapping[*it] != mapping[*(it+1)])
+      cross_sum += 1;
+  return cross_sum;
+}
+
+
+inline long get_flow_crossings(const std::vector<size_t>& mapping,
+			       const FlowPaths& paths,
+			       bool max_flow_crossings,
+			       const Topology* topology = nullptr)
+{
+  // calculates flow crossings, weighted by flow rates
+  long sum = 0;
+  long max = 0;
+  for (size_t c = 0; c < paths.size(); ++c)
+    {
+      long cross_sum = get_path_crossings(paths.begin(c), paths.end(c), mapping, topology);
+      sum += paths.rate(c) * cross_sum;
+      max = std::max(max, paths.peak_rate(c) * cross_sum);
+    }
+
+  if (max_flow_crossings == true)
+    return max;
+  else
+    return sum;
+}
+
+
+inline long get_flow_crossings(const lemon::SmartDigraph& g,
+			       const std::vector<size_t>& mapping,
+			       const std::vector<Flow>& flows,
+			       bool max_flow_crossings,
+			       const Topology* topology = nullptr)
+{
+  return get_flow_crossings(mapping, FlowPaths(g, flows), max_flow_crossings, topology);
+}
+
+
+class DeltaEvaluator
 {
-  // calculates flow crossings
-  std::vector<long> flow_sums;
-    for (const auto& f : flows)
+  // incremental objective evaluation for local moves:
+  // keeps a module -> (flow class, position) inverted index, per-class
+  // crossing counts (costs, with a topology) and per-cpu loads, so that
+  // moving or swapping modules costs time proportional to the flow
+  // degree of the modules involved; modules may be UNMAPPED (not placed
+  // yet), their arcs cost nothing until they are moved to a cpu
+ public:
+  // the selected objective, ties broken by the sum with -maxflow,
+  // compared lexicographically
+  typedef std::pair<long, long> Energy;
+
+  struct Delta
+  {
+    long sum = 0;  // change of the sum crossings objective
+    long max = 0;  // change of the max per-flow crossings objective
+    long value(bool max_obj_func) const { return max_obj_func ? max : sum; }
+    Energy energy(bool max_obj_func) const
+    {
+      return max_obj_func ? Energy(max, sum) : Energy(sum, 0);
+    }
+  };
+
+  DeltaEvaluator(const lemon::SmartDigraph& g,
+		 const std::vector<Cpu>& cpus,
+		 const std::vector<Module>& modules,
+		 const FlowPaths& paths,
+		 const std::vector<size_t>& mapping)
+    : paths_(paths), mapping_(mapping), topology_(get_topology(cpus))
+    {
+      weights_.assign(countNodes(g), 0);
+      for (const auto& module : modules)
+	weights_[g.id(module.node())] = module.weight();
+
+      loads_.assign(cpus.size(), 0);
+      for (const auto& cpu : cpus)
+	{
+	  capacities_.push_back(cpu.capacity());
+	  loads_[cpu.id()] = cpu.load();
+	}
+      for (size_t v = 0; v < mapping_.size(); ++v)
+	if (mapping_[v] != UNMAPPED)
+	  loads_[mapping_[v]] += weights_[v];
+
+      // inverted index, sorted by flow
+      occ_offsets_.assign(mapping_.size() + 1, 0);
+      for (int v : paths_.nodes())
+	++occ_offsets_[v + 1];
+      std::partial_sum(occ_offsets_.begin(), occ_offsets_.end(), occ_offsets_.begin());
+      occ_.resize(paths_.nodes().size());
+      std::vector<size_t> fill(occ_offsets_.begin(), occ_offsets_.end() - 1);
+      for (size_t f = 0; f < paths_.size(); ++f)
+	for (size_t p = 0; p < paths_.length(f); ++p)
+	  occ_[fill[paths_.begin(f)[p]]++] = Occurrence{f, p};
+
+      for (size_t f = 0; f < paths_.size(); ++f)
+	{
+	  long c = 0;
+	  for (const int* it = paths_.begin(f); it + 1 < paths_.end(f); ++it)
+	    c += cost(mapping_[*it], mapping_[*(it+1)]);
+	  crossings_.push_back(c);
+	  sum_ += paths_.rate(f) * c;
+	  max_ = std::max(max_, paths_.peak_rate(f) * c);
+	  ++hist_[paths_.peak_rate(f) * c];
+	}
+    }
+
+  long sum() const { return sum_; }
+  long max() const { return max_; }
+  long value(bool max_obj_func) const { return max_obj_func ? max_ : sum_; }
+  Energy energy(bool max_obj_func) const
+  {
+    return max_obj_func ? Energy(max_, sum_) : Energy(sum_, 0);
+  }
+  // crossings of a flow class, not weighted by its rate
+  long flow_crossings(size_t f) const { return crossings_[f]; }
+  const std::vector<size_t>& mapping() const { return mapping_; }
+  const std::vector<float>& loads() const { return loads_; }
+  float weight(size_t v) const { return weights_[v]; }
+  float capacity(size_t cpu) const { return capacities_[cpu]; }
+
+  bool move_fits(size_t v, size_t cpu) const
+  {
+    // check whether moving v to cpu respects cpu capacity
+    return mapping_[v] == cpu || loads_[cpu] + weights_[v] <= capacities_[cpu];
+  }
+
+  bool swap_fits(size_t u, size_t v) const
+  {
+    // check whether swapping the cpus of u and v respects cpu capacities
+    size_t u_cpu = mapping_[u];
+    size_t v_cpu = mapping_[v];
+    if (u_cpu == v_cpu)
+      return true;
+    float diff = weights_[v] - weights_[u];
+    return (loads_[u_cpu] + diff <= capacities_[u_cpu] &&
+	    loads_[v_cpu] - diff <= capacities_[v_cpu]);
+  }
+
+  Delta move_delta(size_t v, size_t cpu)
+  {
+    // objective change of moving module v to cpu
+    collect(v, cpu, UNMAPPED, UNMAPPED);
+    return delta();
+  }
+
+  Delta swap_delta(size_t u, size_t v)
+  {
+    // objective change of swapping the cpus of modules u and v
+    collect(u, mapping_[v], v, mapping_[u]);
+    return delta();
+  }
+
+  void move(size_t v, size_t cpu)
+  {
+    collect(v, cpu, UNMAPPED, UNMAPPED);
+    if (mapping_[v] != UNMAPPED)
+      loads_[mapping_[v]] -= weights_[v];
+    loads_[cpu] += weights_[v];
+    mapping_[v] = cpu;
+    apply();
+  }
+
+  void swap(size_t u, size_t v)
+  {
+    // both modules must be mapped
+    size_t u_cpu = mapping_[u];
+    size_t v_cpu = mapping_[v];
+    collect(u, v_cpu, v, u_cpu);
+    loads_[u_cpu] += weights_[v] - weights_[u];
+    loads_[v_cpu] += weights_[u] - weights_[v];
+    mapping_[u] = v_cpu;
+    mapping_[v] = u_cpu;
+    apply();
+  }
+
+ private:
+  struct Occurrence
+  {
+    size_t flow;
+    size_t pos;
+  };
+
+  size_t cpu_of(int x) const
+  {
+    if ((size_t) x == mv_) return mv_cpu_;
+    if ((size_t) x == mu_) return mu_cpu_;
+    return mapping_[x];
+  }
+
+  long cost(size_t a_cpu, size_t b_cpu) const
+  {
+    if (a_cpu == UNMAPPED || b_cpu == UNMAPPED)
+      return 0;
+    if (topology_ != nullptr)
+      return topology_->cost(a_cpu, b_cpu);
+    return a_cpu != b_cpu;
+  }
+
+  void add_arc(size_t f, int a, int b)
+  {
+    long d = cost(cpu_of(a), cpu_of(b)) - cost(mapping_[a], mapping_[b]);
+    if (d != 0)
+      touched_.push_back(std::make_pair(f, d));
+  }
+
+  void collect_module(size_t v)
+  {
+    for (size_t k = occ_offsets_[v]; k < occ_offsets_[v+1]; ++k)
+      {
+	const size_t f = occ_[k].flow;
+	const size_t p = occ_[k].pos;
+	const int* path = paths_.begin(f);
+	if (p > 0)
+	  add_arc(f, path[p-1], path[p]);
+	// an arc between two changed modules is counted once, as the
+	// left arc of its second endpoint
+	if (p + 1 < paths_.length(f) &&
+	    (size_t) path[p+1] != mv_ && (size_t) path[p+1] != mu_)
+	  add_arc(f, path[p], path[p+1]);
+      }
+  }
+
+  void collect(size_t v, size_t v_cpu, size_t u, size_t u_cpu)
+  {
+    // gather per-flow crossing changes of the tentative (v, u) relocation
+    mv_ = v;
+    mv_cpu_ = v_cpu;
+    mu_ = u;
+    mu_cpu_ = u_cpu;
+    touched_.clear();
+    collect_module(v);
+    if (u != UNMAPPED)
+      collect_module(u);
+
+    // merge per-flow changes
+    std::sort(touched_.begin(), touched_.end());
+    size_t n = 0;
+    for (size_t k = 0; k < touched_.size(); ++k)
       {
-	size_t cross_sum = 0;
-	for (size_t i = 0; i < f.modules().size()-1; i++)
+	if (n > 0 && touched_[n-1].first == touched_[k].first)
+	  touched_[n-1].second += touched_[k].second;
+	else
+	  touched_[n++] = touched_[k];
+      }
+    touched_.resize(n);
+    mv_ = mu_ = UNMAPPED;
+  }
+
+  Delta delta()
+  {
+    // evaluate the changes collected in touched_
+    Delta d;
+    long new_max = 0;
+    levels_.clear();
+    for (const auto& t : touched_)
+      {
+	if (t.second == 0)
+	  continue;
+	const long peak = paths_.peak_rate(t.first);
+	d.sum += paths_.rate(t.first) * t.second;
+	new_max = std::max(new_max, peak * (crossings_[t.first] + t.second));
+	levels_.push_back(peak * crossings_[t.first]);
+      }
+
+    // highest level still held by an untouched flow
+    std::sort(levels_.begin(), levels_.end(), std::greater<long>());
+    size_t k = 0;
+    for (auto it = hist_.rbegin(); it != hist_.rend() && it->first > new_max; ++it)
+      {
+	size_t removed = 0;
+	while (k < levels_.size() && levels_[k] == it->first)
+	  {
+	    ++removed;
+	    ++k;
+	  }
+	if (it->second > removed)
 	  {
-	    size_t u_cpu = mapping.at(g.id(f.modules()[i].node()));
-	    size_t v_cpu = mapping.at(g.id(f.modules()[i+1].node()));
-	    if (u_cpu != v_cpu)
-	      cross_sum += 1;
+	    new_max = it->first;
+	    break;
 	  }
-	flow_sums.push_back(cross_sum);
       }
+    d.max = new_max - max_;
+    return d;
+  }
 
-  if (max_flow_crossings == true)
-    return *std::max_element(flow_sums.begin(), flow_sums.end());
-  else
-    return std::accumulate(flow_sums.begin(), flow_sums.end(), 0);
-}
+  void apply()
+  {
+    // commit the changes collected in touched_
+    for (const auto& t : touched_)
+      {
+	const long peak = paths_.peak_rate(t.first);
+	long& c = crossings_[t.first];
+	auto level = hist_.find(peak * c);
+	if (--level->second == 0)
+	  hist_.erase(level);
+	c += t.second;
+	++hist_[peak * c];
+	sum_ += paths_.rate(t.first) * t.second;
+      }
+    max_ = hist_.empty() ? 0 : hist_.rbegin()->first;
+  }
+
+  const FlowPaths& paths_;
+  std::vector<size_t> mapping_;
+  const Topology* topology_;
+  std::vector<float> weights_;
+  std::vector<float> capacities_;
+  std::vector<float> loads_;
+  std::vector<size_t> occ_offsets_;
+  std::vector<Occurrence> occ_;
+  std::vector<long> crossings_;
+  std::map<long, size_t> hist_;  // number of classes per peak rate times crossings
+  long sum_ = 0;
+  long max_ = 0;
+
+  // scratch state of the last collect()
+  size_t mv_ = UNMAPPED, mv_cpu_ = UNMAPPED;
+  size_t mu_ = UNMAPPED, mu_cpu_ = UNMAPPED;
+  std::vector<std::pair<size_t, long>> touched_;
+  std::vector<long> levels_;
+};
 
 
-std::set<int> get_conflict_ids(const Module& module,
-			       const lemon::SmartDigraph& dfg,
-			       const lemon::SmartGraph& cg)
+inline std::set<int> get_conflict_ids(const Module& module,
+				      const lemon::SmartDigraph& dfg,
+				      const lemon::SmartGraph& cg)
 {
   // get a set of conflicting modules' IDs
   std::set<int> conflict_ids;
@@ -81,36 +496,370 @@ std::set<int> get_conflict_ids(const Module& module,
 }
 
 
+class Adjacency
+{
+  // CSR neighbour lists of an undirected view of a graph, with optional
+  // per-edge weights
+ public:
+  Adjacency() {}
+  Adjacency(size_t node_num,
+	    const std::vector<std::pair<int, int>>& edges,
+	    const std::vector<long>& weights = std::vector<long>())
+    {
+      offsets_.assign(node_num + 1, 0);
+      for (const auto& e : edges)
+	{
+	  ++offsets_[e.first + 1];
+	  ++offsets_[e.second + 1];
+	}
+      std::partial_sum(offsets_.begin(), offsets_.end(), offsets_.begin());
+      targets_.resize(offsets_.back());
+      if (weights.empty() == false)
+	weights_.resize(offsets_.back());
+      std::vector<size_t> fill(offsets_.begin(), offsets_.end() - 1);
+      for (size_t k = 0; k < edges.size(); ++k)
+	{
+	  const auto& e = edges[k];
+	  if (weights.empty() == false)
+	    {
+	      weights_[fill[e.first]] = weights[k];
+	      weights_[fill[e.second]] = weights[k];
+	    }
+	  targets_[fill[e.first]++] = e.second;
+	  targets_[fill[e.second]++] = e.first;
+	}
+    }
+
+  size_t degree(size_t v) const
+  {
+    return v + 1 < offsets_.size() ? offsets_[v+1] - offsets_[v] : 0;
+  }
+  const int* begin(size_t v) const { return targets_.data() + offsets_[v]; }
+  const int* end(size_t v) const { return begin(v) + degree(v); }
+  const long* weights(size_t v) const { return weights_.data() + offsets_[v]; }
+
+ private:
+  std::vector<size_t> offsets_ = {0};
+  std::vector<int> targets_;
+  std::vector<long> weights_;
+};
+
+
+inline Adjacency get_conflict_adjacency(const lemon::SmartDigraph& dfg,
+					const lemon::SmartGraph& cg)
+{
+  // conflict graph as neighbour lists indexed by module node id
+  std::vector<std::pair<int, int>> edges;
+  for (lemon::SmartGraph::EdgeIt e(cg); e != lemon::INVALID; ++e)
+    edges.push_back(std::make_pair(cg.id(cg.u(e)), cg.id(cg.v(e))));
+  return Adjacency(countNodes(dfg), edges);
+}
+
+
+class ConflictCliques
+{
+  // conflicts as a cover of the conflict graph by cliques (anti-affinity
+  // groups): two modules conflict iff they share a clique; CSR member
+  // lists of the cliques, and the cliques of every module
+ public:
+  ConflictCliques() {}
+  ConflictCliques(size_t node_num, const std::vector<std::vector<int>>& cliques)
+    {
+      of_offsets_.assign(node_num + 1, 0);
+      for (const auto& clique : cliques)
+	{
+	  members_.insert(members_.end(), clique.begin(), clique.end());
+	  offsets_.push_back(members_.size());
+	  for (int v : clique)
+	    ++of_offsets_[v + 1];
+	}
+      std::partial_sum(of_offsets_.begin(), of_offsets_.end(), of_offsets_.begin());
+      of_.resize(of_offsets_.back());
+      std::vector<size_t> fill(of_offsets_.begin(), of_offsets_.end() - 1);
+      for (size_t k = 0; k < cliques.size(); ++k)
+	for (int v : cliques[k])
+	  of_[fill[v]++] = k;
+    }
+
+  size_t size() const { return offsets_.size() - 1; }
+  const int* begin(size_t k) const { return members_.data() + offsets_[k]; }
+  const int* end(size_t k) const { return members_.data() + offsets_[k+1]; }
+
+  // cliques of module v
+  size_t count(size_t v) const
+  {
+    return v + 1 < of_offsets_.size() ? of_offsets_[v+1] - of_offsets_[v] : 0;
+  }
+  const size_t* cliques_begin(size_t v) const { return of_.data() + of_offsets_[v]; }
+  const size_t* cliques_end(size_t v) const { return cliques_begin(v) + count(v); }
+
+ private:
+  std::vector<size_t> offsets_ = {0};
+  std::vector<int> members_;
+  std::vector<size_t> of_offsets_ = {0};
+  std::vector<size_t> of_;
+};
+
+
+inline ConflictCliques get_conflict_cliques(const lemon::SmartDigraph& dfg,
+					    const lemon::SmartGraph& cg)
+{
+  // greedy clique cover of the conflict graph: every edge not covered
+  // yet is grown into a maximal clique among the common neighbours of
+  // its endpoints; replica groups (listed pairwise or as groups) come out
+  // as one clique each
+  const size_t node_num = countNodes(dfg);
+  Adjacency conflicts = get_conflict_adjacency(dfg, cg);
+  std::vector<std::vector<int>> neighbours(node_num);
+  for (size_t v = 0; v < node_num; ++v)
+    {
+      for (const int* u = conflicts.begin(v); u != conflicts.end(v); ++u)
+	if ((size_t) *u != v)
+	  neighbours[v].push_back(*u);
+      std::sort(neighbours[v].begin(), neighbours[v].end());
+      neighbours[v].erase(std::unique(neighbours[v].begin(), neighbours[v].end()),
+			  neighbours[v].end());
+    }
+  auto adjacent = [&neighbours](int u, int v) {
+    return std::binary_search(neighbours[u].begin(), neighbours[u].end(), v);
+  };
+
+  std::vector<std::vector<int>> cliques;
+  std::unordered_set<uint64_t> covered;
+  for (size_t u = 0; u < node_num; ++u)
+    for (int v : neighbours[u])
+      {
+	if ((size_t) v < u || covered.count(uint64_t(u) * node_num + v) > 0)
+	  continue;
+	std::vector<int> clique = {(int) u, v};
+	std::vector<int> common;
+	std::set_intersection(neighbours[u].begin(), neighbours[u].end(),
+			      neighbours[v].begin(), neighbours[v].end(),
+			      std::back_inserter(common));
+	for (int w : common)
+	  if (std::all_of(clique.begin() + 2, clique.end(),
+			  [&](int x) { return adjacent(w, x); }))
+	    clique.push_back(w);
+	std::sort(clique.begin(), clique.end());
+	for (size_t i = 0; i < clique.size(); ++i)
+	  for (size_t j = i + 1; j < clique.size(); ++j)
+	    covered.insert(uint64_t(clique[i]) * node_num + clique[j]);
+	cliques.push_back(clique);
+      }
+  return ConflictCliques(node_num, cliques);
+}
+
+
+inline bool no_conflict_on_cpu(const Adjacency& conflicts,
+			       const std::vector<size_t>& mapping,
+			       size_t v, size_t cpu, size_t ignore = UNMAPPED)
+{
+  // check that no module conflicting with v (except ignore) is on cpu
+  for (const int* it = conflicts.begin(v); it != conflicts.end(v); ++it)
+    if ((size_t) *it != ignore && mapping[*it] == cpu)
+      return false;
+  return true;
+}
+
+
+class CpuConflictMask
+{
+  // per conflict clique bitset of the cpus that host a member of it;
+  // placing a module sets the cpu's bit of each clique of the module, so
+  // checking cpu eligibility is a bit test per clique of the module and
+  // collecting all eligible cpus is a few word-wide operations per clique
+ public:
+  CpuConflictMask(const ConflictCliques& cliques, size_t cpu_num)
+    : cliques_(cliques), cpu_num_(cpu_num), words_((cpu_num + 63) / 64)
+    {
+      bits_.assign(cliques.size() * words_, 0);
+    }
+
+  CpuConflictMask(const ConflictCliques& cliques,
+		  const lemon::SmartDigraph& g, const std::vector<Cpu>& cpus)
+    : CpuConflictMask(cliques, cpus.size())
+    {
+      // account for modules already running on the cpus
+      for (const auto& cpu : cpus)
+	for (const auto& module : cpu.modules())
+	  place(g.id(module.node()), cpu.id());
+    }
+
+  void place(size_t v, size_t cpu)
+  {
+    const uint64_t bit = uint64_t(1) << (cpu % 64);
+    for (const size_t* k = cliques_.cliques_begin(v); k != cliques_.cliques_end(v); ++k)
+      bits_[*k * words_ + cpu / 64] |= bit;
+  }
+
+  bool blocked(size_t v, size_t cpu) const
+  {
+    // v itself counts as placed, only ask for unplaced modules
+    ++checks_;
+    for (const size_t* k = cliques_.cliques_begin(v); k != cliques_.cliques_end(v); ++k)
+      if ((bits_[*k * words_ + cpu / 64] >> (cpu % 64)) & 1)
+	return true;
+    return false;
+  }
+
+  size_t words() const { return words_; }
+  // number of eligibility checks so far, for the metrics
+  size_t checks() const { return checks_; }
+
+  uint64_t eligible_word(size_t v, size_t w) const
+  {
+    // w-th word of the bitset of cpus free of conflicts for v
+    uint64_t word = ~uint64_t(0);
+    for (const size_t* k = cliques_.cliques_begin(v); k != cliques_.cliques_end(v); ++k)
+      word &= ~bits_[*k * words_ + w];
+    if (w == words_ - 1 && cpu_num_ % 64 != 0)
+      word &= (uint64_t(1) << (cpu_num_ % 64)) - 1;
+    return word;
+  }
+
+  template <typename F>
+  void for_each_eligible(size_t v, F f) const
+  {
+    // call f(cpu) for each cpu free of conflicts for v
+    ++checks_;
+    for (size_t w = 0; w < words_; ++w)
+      for (uint64_t word = eligible_word(v, w); word != 0; word &= word - 1)
+	f(w * 64 + __builtin_ctzll(word));
+  }
+
+ private:
+  const ConflictCliques& cliques_;
+  size_t cpu_num_;
+  size_t words_;
+  std::vector<uint64_t> bits_;
+  mutable size_t checks_ = 0;
+};
+
+
+inline long get_flow_crossings_lower_bound(const lemon::SmartDigraph& g,
+					   const std::vector<Cpu>& cpus,
+					   const std::vector<Module>& modules,
+					   const FlowPaths& paths,
+					   const Adjacency& conflicts,
+					   bool max_flow_crossings)
+{
+  // cheap lower bound on the objective: a flow must cross at least once
+  // less than the number of cpus its modules need by weight (filling the
+  // largest free capacities first), and at least once if two of its
+  // modules conflict
+  const Topology* topology = get_topology(cpus);
+  std::vector<float> weights(countNodes(g), 0);
+  for (const auto& module : modules)
+    weights[g.id(module.node())] = module.weight();
+  std::vector<float> free_caps;
+  for (const auto& cpu : cpus)
+    free_caps.push_back(std::max(cpu.capacity() - cpu.load(), 0.0f));
+  std::sort(free_caps.begin(), free_caps.end(), std::greater<float>());
+  // cap_sums[k]: free capacity of the k+1 largest cpus
+  std::vector<float> cap_sums;
+  std::partial_sum(free_caps.begin(), free_caps.end(), std::back_inserter(cap_sums));
+
+  long sum = 0;
+  long max = 0;
+  std::vector<int> path;
+  for (size_t f = 0; f < paths.size(); ++f)
+    {
+      path.assign(paths.begin(f), paths.end(f));
+      std::sort(path.begin(), path.end());
+      path.erase(std::unique(path.begin(), path.end()), path.end());
+
+      float flow_weight = 0;
+      bool has_conflict = false;
+      for (int v : path)
+	{
+	  flow_weight += weights[v];
+	  for (const int* it = conflicts.begin(v); it != conflicts.end(v) && !has_conflict; ++it)
+	    has_conflict = std::binary_search(path.begin(), path.end(), *it);
+	}
+
+      long bound = has_conflict ? 1 : 0;
+      if (cap_sums.empty() == false && cap_sums[0] > 0)
+	{
+	  long needed = std::lower_bound(cap_sums.begin(), cap_sums.end(),
+					 flow_weight * (1 - 1e-6f)) - cap_sums.begin() + 1;
+	  bound = std::max(bound, needed - 1);
+	}
+      // every crossing costs at least the cheapest one, times the rate
+      if (topology != nullptr)
+	bound *= topology->min_cost();
+      sum += paths.rate(f) * bound;
+      max = std::max(max, paths.peak_rate(f) * bound);
+    }
+
+  return max_flow_crossings ? max : sum;
+}
+
+
+inline double get_gap(long value, long lower_bound)
+{
+  // relative gap of an objective value to a lower bound
+  if (value <= lower_bound)
+    return 0;
+  return double(value - lower_bound) / value;
+}
+
+
 class FlowStat
 {
  public:
-  FlowStat(const Flow& flow, const EmbeddingResult& res, const lemon::SmartDigraph& dfg)
+  FlowStat(const FlowPaths& paths, size_t f,
+	   const EmbeddingResult& res, const Topology* topology = nullptr)
     {
-      std::set<size_t> cpus_used;
-      flow_name = flow.name();
-      for (size_t i = 0; i < flow.modules().size() - 1; ++i)
+      // statistics of the path of flow class f, see for_flow()
+      std::vector<size_t> cpus_used;
+      for (const int* it = paths.begin(f); it + 1 < paths.end(f); ++it)
 	{
-	  size_t cur_cpu = res.mapping.at(dfg.id(flow.modules().at(i).node()));
-	  size_t next_cpu = res.mapping.at(dfg.id(flow.modules().at(i+1).node()));
-	  cpus_used.insert(cur_cpu);
+	  size_t cur_cpu = res.mapping[*it];
+	  size_t next_cpu = res.mapping[*(it+1)];
+	  cpus_used.push_back(cur_cpu);
 	  if (cur_cpu != next_cpu)
 	    ++crossings;
 	}
-      cpus = cpus_used.size();
+      if (topology != nullptr)
+	cost = get_path_crossings(paths.begin(f), paths.end(f), res.mapping, topology);
+      has_cost = (topology != nullptr);
+      has_rate = paths.weighted();
+      std::sort(cpus_used.begin(), cpus_used.end());
+      cpus = std::unique(cpus_used.begin(), cpus_used.end()) - cpus_used.begin();
     }
 
+  FlowStat for_flow(const std::string& name, long flow_rate) const
+  {
+    // statistics of a single flow of the class
+    FlowStat retval = *this;
+    retval.flow_name = name;
+    retval.rate = flow_rate;
+    retval.traffic = flow_rate * (has_cost ? cost : crossings);
+    return retval;
+  }
+
   friend std::ostream& operator<<(std::ostream& out, const FlowStat& f);
 
   std::string flow_name;
   size_t crossings = 0;
   size_t cpus = 0;
+  size_t cost = 0;  // crossing cost, with a topology
+  bool has_cost = false;
+  long rate = 1;
+  long traffic = 0;  // rate times crossings (or crossing cost)
+  bool has_rate = false;
 
 };
 
-std::ostream& operator<<(std::ostream& out, const FlowStat& fs)
+inline std::ostream& operator<<(std::ostream& out, const FlowStat& fs)
 {
-  return out << fs.flow_name << ": crossings: " <<  fs.crossings
-	     << ", cpus: " << fs.cpus;
+  out << fs.flow_name << ": crossings: " <<  fs.crossings
+      << ", cpus: " << fs.cpus;
+  if (fs.has_cost == true)
+    out << ", cost: " << fs.cost;
+  if (fs.has_rate == true)
+    out << ", rate: " << fs.rate << ", traffic: " << fs.traffic;
+  return out;
 }
 
 
@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMBED_DECOMPOSE_H
+#define EMBED_DECOMPOSE_H
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "embed-common.h"
+#include "flow.h"
+#include "instance.h"
+#include "module.h"
+
+using namespace lemon;
+
+
+// embeds a single (sub)instance
+typedef std::function<EmbeddingResult(const Instance&)> InstanceEmbedder;
+
+
+struct DecomposeStat
+{
+  size_t components = 0;
+  size_t parts = 0;  // groups of components embedded concurrently
+  size_t resolved = 0;  // components re-embedded on the residual capacity
+  bool undecomposed = false;  // the residual did not suffice either
+};
+
+
+class _UnionFind
+{
+ public:
+  _UnionFind(size_t n) : parent_(n) { std::iota(parent_.begin(), parent_.end(), 0); }
+
+  size_t find(size_t v)
+  {
+    while (parent_[v] != v)
+      v = parent_[v] = parent_[parent_[v]];
+    return v;
+  }
+
+  void join(size_t u, size_t v) { parent_[find(u)] = find(v); }
+
+ private:
+  std::vector<size_t> parent_;
+};
+
+
+inline std::vector<std::vector<int>> get_components(const SmartDigraph& g,
+						    const SmartGraph& cg,
+						    const FlowPaths& paths)
+{
+  // connected components of the dfg, the conflict graph and the flow
+  // paths together, as sorted node id lists; no flow crosses and no
+  // conflict spans two components, so they can be embedded separately
+  const size_t node_num = countNodes(g);
+  _UnionFind uf(node_num);
+  for (SmartDigraph::ArcIt a(g); a != INVALID; ++a)
+    uf.join(g.id(g.source(a)), g.id(g.target(a)));
+  for (SmartGraph::EdgeIt e(cg); e != INVALID; ++e)
+    uf.join(cg.id(cg.u(e)), cg.id(cg.v(e)));
+  for (size_t f = 0; f < paths.size(); ++f)
+    for (const int* it = paths.begin(f); it + 1 < paths.end(f); ++it)
+      uf.join(*it, *(it+1));
+
+  std::vector<size_t> comp_idx(node_num, UNMAPPED);
+  std::vector<std::vector<int>> components;
+  for (size_t v = 0; v < node_num; ++v)
+    {
+      size_t root = uf.find(v);
+      if (comp_idx[root] == UNMAPPED)
+	{
+	  comp_idx[root] = components.size();
+	  components.push_back(std::vector<int>());
+	}
+      components[comp_idx[root]].push_back(v);
+    }
+  return components;
+}
+
+
+inline void build_subinstance(Instance& sub,
+			      const SmartDigraph& g,
+			      const SmartGraph& cg,
+			      const std::vector<Flow>& flows,
+			      const std::vector<Module>& modules,
+			      const std::vector<int>& nodes,
+			      const std::vector<float>& capacities,
+			      const std::shared_ptr<const Topology>& topology = nullptr)
+{
+  // copies the part of an instance induced by nodes (sorted ids) into
+  // sub, keeping the relative order of nodes, arcs, edges and flows
+  const size_t node_num = countNodes(g);
+  std::vector<size_t> sub_id(node_num, UNMAPPED);
+  for (size_t k = 0; k < nodes.size(); ++k)
+    sub_id[nodes[k]] = k;
+
+  for (size_t k = 0; k < nodes.size(); ++k)
+    sub.dfg.addNode();
+  for (int a = 0; a <= g.maxArcId(); ++a)
+    {
+      SmartDigraph::Arc arc = g.arcFromId(a);
+      size_t s = sub_id[g.id(g.source(arc))];
+      size_t t = sub_id[g.id(g.target(arc))];
+      if (s != UNMAPPED)
+	sub.dfg.addArc(sub.dfg.nodeFromId(s), sub.dfg.nodeFromId(t));
+    }
+
+  if (countNodes(cg) > 0)
+    {
+      for (size_t k = 0; k < nodes.size(); ++k)
+	sub.cg.addNode();
+      for (int e = 0; e <= cg.maxEdgeId(); ++e)
+	{
+	  SmartGraph::Edge edge = cg.edgeFromId(e);
+	  size_t u = sub_id[cg.id(cg.u(edge))];
+	  size_t v = sub_id[cg.id(cg.v(edge))];
+	  if (u != UNMAPPED)
+	    sub.cg.addEdge(sub.cg.nodeFromId(u), sub.cg.nodeFromId(v));
+	}
+    }
+
+  std::vector<Module> sub_module(nodes.size());
+  for (const auto& module : modules)
+    {
+      size_t k = sub_id[g.id(module.node())];
+      if (k == UNMAPPED)
+	continue;
+      SmartDigraph::Node n = sub.dfg.nodeFromId(k);
+      sub_module[k] = Module(n, module.name(), module.weight());
+      sub.modules.push_back(sub_module[k]);
+    }
+
+  for (const auto& flow : flows)
+    {
+      if (flow.modules().empty() ||
+	  sub_id[g.id(flow.modules()[0].node())] == UNMAPPED)
+	continue;
+      std::vector<Module> path;
+      for (const auto& m : flow.modules())
+	path.push_back(sub_module[sub_id[g.id(m.node())]]);
+      sub.flows.push_back(Flow(flow.name(), path, flow.rate()));
+    }
+
+  for (size_t i = 0; i < capacities.size(); ++i)
+    {
+      sub.cpus.push_back(Cpu(i, capacities[i]));
+      sub.cpus.back().set_topology(topology);
+    }
+}
+
+
+inline std::shared_ptr<const Topology> _sub_topology(const std::shared_ptr<const Topology>& topology,
+						    const std::vector<size_t>& cpu_ids)
+{
+  // the topology of a subset of the cpus, renumbered in the given order
+  if (topology == nullptr)
+    return nullptr;
+  std::vector<size_t> cores, numas, sockets;
+  for (size_t cpu : cpu_ids)
+    {
+      cores.push_back(topology->cores()[cpu]);
+      numas.push_back(topology->numas()[cpu]);
+      sockets.push_back(topology->sockets()[cpu]);
+    }
+  return std::make_shared<const Topology>(cores, numas, sockets, topology->costs());
+}
+
+
+inline EmbeddingResult embed_decomposed(const SmartDigraph& g,
+					const SmartGraph& cg,
+					const std::vector<Cpu>& cpus,
+					const std::vector<Flow>& flows,
+					const std::vector<Module>& modules,
+					const InstanceEmbedder& embed,
+					bool max_obj_func = false,
+					size_t threads = 0,
+					DecomposeStat* stat = nullptr)
+{
+  // splits the instance into independent components, packs them into at
+  // most as many parts as cpus, deals the whole cpus out to the parts in
+  // proportion to their weight and embeds the parts concurrently, each on
+  // its own cpus, then merges the results; the components of parts that
+  // do not fit their cpus are re-embedded one by one on the residual
+  // capacity of all cpus, and if the residual gets too fragmented, the
+  // whole instance is embedded
+  const size_t node_num = countNodes(g);
+  FlowPaths paths(g, flows);
+  std::vector<std::vector<int>> components = get_components(g, cg, paths);
+  std::shared_ptr<const Topology> topology;
+  if (cpus.empty() == false)
+    topology = cpus[0].shared_topology();
+
+  std::vector<float> weights(node_num, 0);
+  for (const auto& module : modules)
+    weights[g.id(module.node())] = module.weight();
+  std::vector<float> comp_weights;
+  float total_weight = 0;
+  for (const auto& comp : components)
+    {
+      float w = 0;
+      for (int v : comp)
+	w += weights[v];
+      comp_weights.push_back(w);
+      total_weight += w;
+    }
+
+  // heaviest components first, for packing and load balancing
+  std::vector<size_t> order(components.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return comp_weights[a] > comp_weights[b];
+    });
+
+  // disabled (and full) cpus are left out of the parts
+  std::vector<float> free_caps;
+  std::vector<size_t> usable;
+  float total_free = 0;
+  for (const auto& cpu : cpus)
+    {
+      free_caps.push_back(cpu.capacity() - cpu.load());
+      if (free_caps.back() > 0)
+	{
+	  usable.push_back(cpu.id());
+	  total_free += free_caps.back();
+	}
+    }
+  std::stable_sort(usable.begin(), usable.end(), [&](size_t a, size_t b) {
+      return free_caps[a] > free_caps[b];
+    });
+
+  // parts: each component goes to the lightest part (LPT)
+  typedef std::pair<float, size_t> Entry;
+  const size_t part_num = std::min(components.size(), std::max<size_t>(usable.size(), 1));
+  std::vector<std::vector<size_t>> parts(part_num);
+  std::vector<float> part_weights(part_num, 0);
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> lightest;
+  for (size_t p = 0; p < part_num; ++p)
+    lightest.push(Entry(0, p));
+  for (size_t c : order)
+    {
+      size_t p = lightest.top().second;
+      lightest.pop();
+      parts[p].push_back(c);
+      part_weights[p] += comp_weights[c];
+      lightest.push(Entry(part_weights[p], p));
+    }
+
+  // cpus, largest first, each to the part furthest below its
+  // weight-proportional share of the free capacity
+  std::vector<std::vector<size_t>> part_cpus(part_num);
+  std::priority_queue<Entry> neediest;
+  for (size_t p = 0; p < part_num; ++p)
+    neediest.push(Entry(total_weight > 0 ? part_weights[p] / total_weight * total_free :
+			total_free / part_num, p));
+  for (size_t cpu : usable)
+    {
+      Entry e = neediest.top();
+      neediest.pop();
+      part_cpus[e.second].push_back(cpu);
+      neediest.push(Entry(e.first - free_caps[cpu], e.second));
+    }
+
+  std::vector<EmbeddingResult> results(part_num);
+  std::vector<char> ok(part_num, false);
+  std::atomic<size_t> next(0);
+  std::exception_ptr error = nullptr;
+  std::mutex error_lock;
+
+  // nodes of a part, as a sorted id list
+  auto part_nodes = [&](size_t p) {
+    std::vector<int> nodes;
+    for (size_t c : parts[p])
+      nodes.insert(nodes.end(), components[c].begin(), components[c].end());
+    std::sort(nodes.begin(), nodes.end());
+    return nodes;
+  };
+
+  auto worker = [&]() {
+    size_t p;
+    while ((p = next++) < part_num)
+      {
+	if (part_cpus[p].empty())
+	  continue;
+	std::vector<float> capacities;
+	for (size_t cpu : part_cpus[p])
+	  capacities.push_back(free_caps[cpu]);
+	try {
+	  Instance sub;
+	  build_subinstance(sub, g, cg, flows, modules, part_nodes(p), capacities,
+			    _sub_topology(topology, part_cpus[p]));
+	  results[p] = embed(sub);
+	  for (size_t& cpu : results[p].mapping)
+	    cpu = part_cpus[p][cpu];
+	  ok[p] = true;
+	} catch (EmbeddingInfeasible&) {
+	  // does not fit its cpus, retried on the residual capacity
+	} catch (...) {
+	  std::lock_guard<std::mutex> guard(error_lock);
+	  error = std::current_exception();
+	}
+      }
+  };
+
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, std::max<size_t>(part_num, 1));
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t)
+    pool.push_back(std::thread(worker));
+  worker();
+  for (auto& t : pool)
+    t.join();
+  if (error != nullptr)
+    std::rethrow_exception(error);
+
+  // merge
+  EmbeddingResult retval;
+  retval.mapping.assign(node_num, UNMAPPED);
+  bool bounded = true;
+  std::vector<float> loads(cpus.size(), 0);
+  auto merge = [&](const std::vector<int>& nodes, const EmbeddingResult& res) {
+    for (size_t k = 0; k < nodes.size(); ++k)
+      {
+	size_t cpu = res.mapping[k];
+	retval.mapping[nodes[k]] = cpu;
+	loads[cpu] += weights[nodes[k]];
+      }
+    bounded = bounded && res.gap >= 0;
+  };
+  for (size_t p = 0; p < part_num; ++p)
+    if (ok[p] == true)
+      merge(part_nodes(p), results[p]);
+
+  DecomposeStat st;
+  st.components = components.size();
+  st.parts = part_num;
+  try {
+    for (size_t c : order)
+      {
+	if (retval.mapping[components[c][0]] != UNMAPPED)
+	  continue;
+	std::vector<float> capacities;
+	for (size_t i = 0; i < cpus.size(); ++i)
+	  capacities.push_back(free_caps[i] > 0 ? std::max(free_caps[i] - loads[i], 0.0f) : -1);
+	Instance sub;
+	build_subinstance(sub, g, cg, flows, modules, components[c], capacities,
+			  topology);
+	merge(components[c], embed(sub));
+	++st.resolved;
+      }
+  } catch (EmbeddingInfeasible&) {
+    std::vector<int> nodes(node_num);
+    std::iota(nodes.begin(), nodes.end(), 0);
+    std::vector<float> capacities;
+    for (float cap : free_caps)
+      capacities.push_back(cap > 0 ? cap : -1);
+    Instance whole;
+    build_subinstance(whole, g, cg, flows, modules, nodes, capacities, topology);
+    retval = embed(whole);
+    st.undecomposed = true;
+  }
+
+  retval.sol_value = get_flow_crossings(retval.mapping, paths, max_obj_func,
+					get_topology(cpus));
+  // the parts are solved on a subset of the cpus, so their gaps (even 0)
+  // say nothing of the whole: if the method bounds its results, the gap
+  // is taken against the lower bound of the whole instance
+  if (st.undecomposed == false)
+    retval.gap = bounded == false ? -1 :
+      get_gap(retval.sol_value,
+	      get_flow_crossings_lower_bound(g, cpus, modules, paths,
+					     get_conflict_adjacency(g, cg),
+					     max_obj_func));
+  if (stat != nullptr)
+    *stat = st;
+
+  return retval;
+}
+
+
+#endif  // EMBED_DECOMPOSE_H
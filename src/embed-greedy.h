@@ -18,49 +18,252 @@
 #ifndef EMBED_GREEDY_H
 #define EMBED_GREEDY_H
 
+#include <memory>
+#include <queue>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
+#include <lemon/smart_graph.h>
 
 #include "embed-common.h"
+#include "metrics.h"
 
 using namespace lemon;
 
 
-EmbeddingResult _embed_greedy_conflictfree(const SmartDigraph& g,
-					   const SmartGraph& cg,
-					   const std::vector<Cpu>& cpus,
-					   const std::vector<Flow>& flows,
-					   const std::vector<Module>& modules,
-					   bool max_obj_func = false)
+inline EmbeddingResult _embed_greedy(const SmartDigraph& g,
+				     const SmartGraph& cg,
+				     const std::vector<Cpu>& cpus,
+				     const std::vector<Flow>& flows,
+				     const std::vector<Module>& modules,
+				     bool max_obj_func,
+				     bool check_conflicts)
 {
-  // TODO
+  // grows cpu-local clusters along flows: the next module to place is
+  // the one whose placement turns the most flow arc traversals
+  // cpu-local, i.e., the (v, i) pair with the largest sum of flow arc
+  // weights between v and the modules already on cpu i
+  const size_t node_num = countNodes(g);
+  const size_t cpu_num = cpus.size();
 
   EmbeddingResult retval;
+  retval.mapping.assign(node_num, UNMAPPED);
 
+  // flow arc weights: number of flow traversals of each module pair,
+  // weighted by the flow rates
+  FlowPaths paths(g, flows);
+  std::unordered_map<uint64_t, long> arc_traversals;
+  for (size_t f = 0; f < paths.size(); ++f)
+    for (const int* it = paths.begin(f); it + 1 < paths.end(f); ++it)
+      {
+	uint64_t u = std::min(*it, *(it+1));
+	uint64_t v = std::max(*it, *(it+1));
+	if (u != v)
+	  arc_traversals[u * node_num + v] += paths.rate(f);
+      }
+  std::vector<std::pair<int, int>> arcs;
+  std::vector<long> arc_weights;
+  for (const auto& it : arc_traversals)
+    {
+      arcs.push_back(std::make_pair(it.first / node_num, it.first % node_num));
+      arc_weights.push_back(it.second);
+    }
+  Adjacency flow_adj(node_num, arcs, arc_weights);
+
+  ConflictCliques cliques;
+  if (check_conflicts == true)
+    cliques = get_conflict_cliques(g, cg);
+  CpuConflictMask conflict_mask(cliques, g, cpus);
+
+  // modules may be a subset of the dfg nodes (decomposition parts,
+  // re-embedding), only those are placed
+  std::vector<float> weights(node_num, 0);
+  std::vector<bool> selected(node_num, false);
+  for (const auto& module : modules)
+    {
+      weights[g.id(module.node())] = module.weight();
+      selected[g.id(module.node())] = true;
+    }
+  const Topology* topology = get_topology(cpus);
+
+  // with -maxflow, the objective change of placing a module picks its cpu
+  // among those of its flow neighbours, the gains only order the modules
+  std::unique_ptr<DeltaEvaluator> eval;
+  if (max_obj_func == true)
+    eval.reset(new DeltaEvaluator(g, cpus, modules, paths, retval.mapping));
+
+  // cpus ordered by free capacity, to open new clusters on
+  std::vector<float> free_caps(cpu_num);
+  std::set<std::pair<float, size_t>> cpus_by_free_cap;
+  for (const auto& cpu : cpus)
+    {
+      free_caps[cpu.id()] = cpu.capacity() - cpu.load();
+      cpus_by_free_cap.insert(std::make_pair(free_caps[cpu.id()], cpu.id()));
+    }
+
+  // modules ordered by decreasing weight, to seed new clusters with
+  std::vector<size_t> seeds;
+  for (const auto& module : modules)
+    seeds.push_back(g.id(module.node()));
+  std::stable_sort(seeds.begin(), seeds.end(), [&weights](size_t u, size_t v) {
+      return weights[u] > weights[v];
+    });
+  size_t next_seed = 0;
+
+  // (gain, module, cpu) candidates, outdated entries are skipped lazily
+  typedef std::tuple<long, size_t, size_t> Candidate;
+  std::priority_queue<Candidate> queue;
+  std::unordered_map<uint64_t, long> gains;
+
+  auto eligible = [&](size_t v, size_t cpu) {
+    return (weights[v] <= free_caps[cpu] && conflict_mask.blocked(v, cpu) == false);
+  };
+
+  auto place = [&](size_t v, size_t cpu) {
+    if (eval)
+      eval->move(v, cpu);
+    retval.mapping[v] = cpu;
+    conflict_mask.place(v, cpu);
+    cpus_by_free_cap.erase(std::make_pair(free_caps[cpu], cpu));
+    free_caps[cpu] -= weights[v];
+    cpus_by_free_cap.insert(std::make_pair(free_caps[cpu], cpu));
+
+    const long* w = flow_adj.weights(v);
+    for (const int* it = flow_adj.begin(v); it != flow_adj.end(v); ++it, ++w)
+      if (selected[*it] == true && retval.mapping[*it] == UNMAPPED)
+	{
+	  long& gain = gains[*it * cpu_num + cpu];
+	  gain += *w;
+	  queue.push(Candidate(gain, *it, cpu));
+	}
+  };
+
+  size_t candidates = 0;
+  size_t scanned = 0;
+  for (size_t placed = 0; placed < modules.size(); )
+    {
+      if (queue.empty() == false)
+	{
+	  Candidate c = queue.top();
+	  queue.pop();
+	  ++candidates;
+	  size_t v = std::get<1>(c);
+	  size_t cpu = std::get<2>(c);
+	  if (retval.mapping[v] != UNMAPPED ||
+	      std::get<0>(c) != gains[v * cpu_num + cpu] ||
+	      eligible(v, cpu) == false)
+	    continue;
+	  if (eval)
+	    {
+	      DeltaEvaluator::Energy best = eval->move_delta(v, cpu).energy(true);
+	      for (const int* u = flow_adj.begin(v); u != flow_adj.end(v); ++u)
+		{
+		  size_t u_cpu = retval.mapping[*u];
+		  if (u_cpu == UNMAPPED || u_cpu == cpu || eligible(v, u_cpu) == false)
+		    continue;
+		  DeltaEvaluator::Energy e = eval->move_delta(v, u_cpu).energy(true);
+		  if (e < best)
+		    {
+		      best = e;
+		      cpu = u_cpu;
+		    }
+		}
+	    }
+	  place(v, cpu);
+	  ++placed;
+	  continue;
+	}
+
+      // no module gains from any cpu: open a new cluster with the
+      // heaviest unplaced module on the emptiest eligible cpu, or with a
+      // topology, on the eligible cpu closest to its placed neighbours;
+      // with -maxflow, on the eligible cpu of the least objective change
+      while (next_seed < seeds.size() && retval.mapping[seeds[next_seed]] != UNMAPPED)
+	++next_seed;
+      if (next_seed == seeds.size())
+	break;
+      size_t v = seeds[next_seed];
+      size_t idx = UNMAPPED;
+      long best_cost = 0;
+      DeltaEvaluator::Energy best_energy;
+      for (auto it = cpus_by_free_cap.rbegin(); it != cpus_by_free_cap.rend(); ++it)
+	{
+	  if (it->first < weights[v])
+	    break;
+	  ++scanned;
+	  if (eligible(v, it->second) == false)
+	    continue;
+	  if (eval)
+	    {
+	      DeltaEvaluator::Energy e = eval->move_delta(v, it->second).energy(true);
+	      if (idx == UNMAPPED || e < best_energy)
+		{
+		  idx = it->second;
+		  best_energy = e;
+		}
+	      continue;
+	    }
+	  if (topology == nullptr)
+	    {
+	      idx = it->second;
+	      break;
+	    }
+	  long cost = 0;
+	  const long* w = flow_adj.weights(v);
+	  for (const int* u = flow_adj.begin(v); u != flow_adj.end(v); ++u, ++w)
+	    if (retval.mapping[*u] != UNMAPPED)
+	      cost += *w * topology->cost(it->second, retval.mapping[*u]);
+	  if (idx == UNMAPPED || cost < best_cost)
+	    {
+	      idx = it->second;
+	      best_cost = cost;
+	    }
+	}
+      if (idx == UNMAPPED)
+	throw EmbeddingInfeasible("Embedding not possible: out of available CPUs");
+      place(v, idx);
+      ++placed;
+    }
+  metrics().add("greedy_candidates", candidates);
+  metrics().add("bins_scanned", scanned);
+  metrics().add("conflict_checks", conflict_mask.checks());
+
+  retval.sol_value = get_flow_crossings(retval.mapping, paths, max_obj_func,
+					get_topology(cpus));
   return retval;
 }
 
 
-EmbeddingResult _embed_greedy_conflicts(const SmartDigraph& g,
-					const SmartGraph& cg,
-					const std::vector<Cpu>& cpus,
-					const std::vector<Flow>& flows,
-					const std::vector<Module>& modules,
-					bool max_obj_func = false)
+inline EmbeddingResult _embed_greedy_conflictfree(const SmartDigraph& g,
+						  const SmartGraph& cg,
+						  const std::vector<Cpu>& cpus,
+						  const std::vector<Flow>& flows,
+						  const std::vector<Module>& modules,
+						  bool max_obj_func = false)
 {
-  // TODO
+  return _embed_greedy(g, cg, cpus, flows, modules, max_obj_func, false);
+}
 
-  EmbeddingResult retval;
 
-  return retval;
+inline EmbeddingResult _embed_greedy_conflicts(const SmartDigraph& g,
+					       const SmartGraph& cg,
+					       const std::vector<Cpu>& cpus,
+					       const std::vector<Flow>& flows,
+					       const std::vector<Module>& modules,
+					       bool max_obj_func = false)
+{
+  return _embed_greedy(g, cg, cpus, flows, modules, max_obj_func, true);
 }
 
 
-EmbeddingResult embed_greedy(const SmartDigraph& g,
-			     const SmartGraph& cg,
-			     const std::vector<Cpu>& cpus,
-			     const std::vector<Flow>& flows,
-			     const std::vector<Module>& modules,
-			     bool max_obj_func = false)
+inline EmbeddingResult embed_greedy(const SmartDigraph& g,
+				    const SmartGraph& cg,
+				    const std::vector<Cpu>& cpus,
+				    const std::vector<Flow>& flows,
+				    const std::vector<Module>& modules,
+				    bool max_obj_func = false)
 {
  if (countEdges(cg) == 0)
     return _embed_greedy_conflictfree(g, cg, cpus, flows, modules, max_obj_func);
@@ -18,30 +18,209 @@
 #ifndef EMBED_ILP_H
 #define EMBED_ILP_H
 
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <memory>
 #include <vector>
 #include <stdexcept>
 #include <lemon/smart_graph.h>
 #include <lemon/lp.h>
+// the native interface of the MIP backend behind LEMON's Mip, selected by
+// MIP_BACKEND in the Makefile (a CPLEX default MIP of LEMON is detected)
+#if !defined(DFG_MIP_GUROBI) && !defined(DFG_MIP_CPLEX) && defined(LEMON_DEFAULT_MIP) && \
+  defined(_LEMON_CPLEX) && LEMON_DEFAULT_MIP == _LEMON_CPLEX
+#define DFG_MIP_CPLEX 1
+#endif
+#if defined(DFG_MIP_GUROBI)
+#include <gurobi_c.h>
+#define DFG_ILP_NATIVE_PARAMS 1
+#elif defined(DFG_MIP_CPLEX)
+#include <ilcplex/cplex.h>
+#define DFG_ILP_NATIVE_PARAMS 1
+#endif
 
 #include "cpu.h"
 #include "embed-common.h"
 #include "flow.h"
+#include "metrics.h"
 #include "utils.h"
 
 using namespace lemon;
 using namespace std;
 
 
-EmbeddingResult embed_ilp(const SmartDigraph& g,
-			  const SmartGraph& cg,
-			  const vector<Cpu>& cpus,
-			  const vector<Flow>& flows,
-			  const vector<Module>& modules,
-			  bool max_obj_func = false,
-			  bool show_solver_log = true)
+struct IlpOptions
 {
+  double time_limit = 0;  // solver time budget [s], 0: no limit
+  double mip_gap = 0;  // accepted relative gap of the incumbent
+  int threads = 0;  // solver threads, 0: solver default
+  bool symmetry_breaking = true;  // only applied to identical cpus
+  const EmbeddingResult* mip_start = nullptr;  // heuristic incumbent
+  // re-embedding: modules may not use disabled cpus, and at most
+  // max_migrations modules may leave their previous (enabled) cpu
+  std::vector<size_t> disabled_cpus;
+  const std::vector<size_t>* previous = nullptr;
+  long max_migrations = -1;
+};
+
+
+inline bool ilp_solver_params_supported()
+{
+  // LEMON's MIP interface has no time limit, thread or gap parameters,
+  // these are only passed to backends that expose their native handles
+#ifdef DFG_ILP_NATIVE_PARAMS
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+inline void set_ilp_solver_params(Mip& mip, const IlpOptions& opts)
+{
+  // without native parameters the solver runs single threaded, to
+  // optimality; a time limit cannot be enforced, so it is refused
+#if defined(DFG_MIP_GUROBI)
+  GRBenv* env = GRBgetenv(mip.grbModel());
+  if (opts.threads > 0)
+    GRBsetintparam(env, GRB_INT_PAR_THREADS, opts.threads);
+  if (opts.mip_gap > 0)
+    GRBsetdblparam(env, GRB_DBL_PAR_MIPGAP, opts.mip_gap);
+  if (opts.time_limit > 0)
+    GRBsetdblparam(env, GRB_DBL_PAR_TIMELIMIT, opts.time_limit);
+#elif defined(DFG_MIP_CPLEX)
+  if (opts.threads > 0)
+    CPXsetintparam(mip.cplexEnv(), CPX_PARAM_THREADS, opts.threads);
+  if (opts.mip_gap > 0)
+    CPXsetdblparam(mip.cplexEnv(), CPX_PARAM_EPGAP, opts.mip_gap);
+  if (opts.time_limit > 0)
+    CPXsetdblparam(mip.cplexEnv(), CPX_PARAM_TILIM, opts.time_limit);
+#else
+  if (opts.time_limit > 0)
+    throw std::runtime_error("The MIP backend does not support a time limit");
+#endif
+}
+
+
+inline bool set_ilp_solver_start(Mip& mip, const std::vector<LpBase::Col>& cols,
+				 const std::vector<double>& values)
+{
+  // pass a (partial) starting solution to the solver, returns false if
+  // the backend cannot take one; columns are never erased, so the native
+  // index of a column is its LEMON id
+#if defined(DFG_MIP_GUROBI)
+  GRBmodel* model = mip.grbModel();
+  if (GRBupdatemodel(model) != 0)
+    return false;
+  for (size_t k = 0; k < cols.size(); ++k)
+    if (GRBsetdblattrelement(model, GRB_DBL_ATTR_START, Mip::id(cols[k]), values[k]) != 0)
+      return false;
+  return true;
+#elif defined(DFG_MIP_CPLEX)
+  std::vector<int> indices;
+  for (const auto& col : cols)
+    indices.push_back(Mip::id(col));
+  int beg = 0;
+  int effort = CPX_MIPSTART_AUTO;
+  return CPXaddmipstarts(mip.cplexEnv(), mip.cplexLp(), 1, indices.size(), &beg,
+			 indices.data(), values.data(), &effort, nullptr) == 0;
+#else
+  return false;
+#endif
+}
+
+
+inline bool get_ilp_solver_incumbent(Mip& mip)
+{
+  // whether the last solve found a feasible solution, also when it was
+  // stopped by a limit (which LEMON reports as undefined)
+  if (mip.type() == Mip::OPTIMAL || mip.type() == Mip::FEASIBLE)
+    return true;
+#if defined(DFG_MIP_GUROBI)
+  int count;
+  return GRBgetintattr(mip.grbModel(), GRB_INT_ATTR_SOLCOUNT, &count) == 0 && count > 0;
+#elif defined(DFG_MIP_CPLEX)
+  int method, type, primal_feasible, dual_feasible;
+  return CPXsolninfo(mip.cplexEnv(), mip.cplexLp(), &method, &type,
+		     &primal_feasible, &dual_feasible) == 0 && primal_feasible != 0;
+#else
+  return false;
+#endif
+}
+
+
+inline long get_ilp_solver_bound(Mip& mip, long lower_bound)
+{
+  // best objective bound of the last solve, at least lower_bound
+#if defined(DFG_MIP_GUROBI)
+  double bound;
+  if (GRBgetdblattr(mip.grbModel(), GRB_DBL_ATTR_OBJBOUND, &bound) == 0)
+    return std::max(lower_bound, (long) std::ceil(bound - 1e-6));
+#elif defined(DFG_MIP_CPLEX)
+  double bound;
+  if (CPXgetbestobjval(mip.cplexEnv(), mip.cplexLp(), &bound) == 0)
+    return std::max(lower_bound, (long) std::ceil(bound - 1e-6));
+#endif
+  return lower_bound;
+}
+
+
+inline long get_ilp_solver_nodes(Mip& mip)
+{
+  // branch-and-bound nodes of the last solve, or -1 if the backend does
+  // not expose them
+#if defined(DFG_MIP_GUROBI)
+  double nodes;
+  if (GRBgetdblattr(mip.grbModel(), GRB_DBL_ATTR_NODECOUNT, &nodes) == 0)
+    return std::lround(nodes);
+  return -1;
+#elif defined(DFG_MIP_CPLEX)
+  return CPXgetnodecnt(mip.cplexEnv(), mip.cplexLp());
+#else
+  return -1;
+#endif
+}
+
+
+inline bool cpus_identical(const vector<Cpu>& cpus)
+{
+  // cpus are interchangeable if they are empty, of the same capacity and
+  // equally far from each other
+  if (get_topology(cpus) != nullptr)
+    return false;
+  for (const auto& cpu : cpus)
+    if (cpu.capacity() != cpus[0].capacity() || cpu.modules().empty() == false)
+      return false;
+  return true;
+}
+
+
+inline EmbeddingResult embed_ilp(const SmartDigraph& g,
+				 const SmartGraph& cg,
+				 const vector<Cpu>& cpus,
+				 const vector<Flow>& flows,
+				 const vector<Module>& modules,
+				 bool max_obj_func = false,
+				 bool show_solver_log = true,
+				 const IlpOptions& opts = IlpOptions())
+{
+  auto t_build = std::chrono::steady_clock::now();
   ArcLookUp<SmartDigraph> arclookup(g);
 
+  // a heuristic incumbent already within the accepted gap needs no solve
+  FlowPaths paths(g, flows);
+  long lower_bound = get_flow_crossings_lower_bound(g, cpus, modules, paths,
+						    get_conflict_adjacency(g, cg),
+						    max_obj_func);
+  if (opts.mip_start != nullptr &&
+      get_gap(opts.mip_start->sol_value, lower_bound) <= opts.mip_gap)
+    {
+      EmbeddingResult retval = *opts.mip_start;
+      retval.gap = get_gap(retval.sol_value, lower_bound);
+      return retval;
+    }
+
   Mip mapping;
   if (show_solver_log == true)
     mapping.messageLevel(LpBase::MESSAGE_NORMAL);
@@ -74,6 +253,41 @@ EmbeddingResult embed_ilp(const SmartDigraph& g,
       }
     }
 
+  // symmetry breaking for identical cpus: numbering cpus by the first
+  // module they host, the k-th module can only be on cpus 0..k
+  // x_{v_k i} = 0, \forall i > k
+  const bool symmetry_breaking = (opts.symmetry_breaking == true && cpus_identical(cpus) &&
+				 opts.disabled_cpus.empty() && opts.previous == nullptr);
+  if (symmetry_breaking == true)
+    {
+      size_t k = 0;
+      for (SmartDigraph::NodeIt n(g); n != INVALID; ++n, ++k)
+	for (size_t i = k + 1; i < cpus.size(); i++)
+	  mapping.colUpperBound(x[n][i], 0);
+    }
+
+  // x_{vi} = 0, \forall v, i \in disabled
+  std::vector<char> enabled(cpus.size(), true);
+  for (size_t i : opts.disabled_cpus)
+    {
+      enabled.at(i) = false;
+      for (SmartDigraph::NodeIt n(g); n != INVALID; ++n)
+	mapping.colUpperBound(x[n][i], 0);
+    }
+
+  // \sum\limits_{v: p(v) \in enabled} (1 - x_{v p(v)}) \le budget
+  if (opts.previous != nullptr && opts.max_migrations >= 0)
+    {
+      Lp::Expr e;
+      for (SmartDigraph::NodeIt n(g); n != INVALID; ++n)
+	{
+	  size_t p = opts.previous->at(g.id(n));
+	  if (enabled[p] == true)
+	    e += 1 - x[n][p];
+	}
+      mapping.addRow(e <= opts.max_migrations);
+    }
+
   // \sum\limits_{i \in N} x_{vi} = 1, \forall v \in V
   for (SmartDigraph::NodeIt n(g); n != INVALID; ++n)
     {
@@ -83,13 +297,14 @@ EmbeddingResult embed_ilp(const SmartDigraph& g,
       mapping.addRow(e == 1);
     }
 
-  // \sum\limits_{v \in V} w_{v} x_{vi} \leq C
+  // \sum\limits_{v \in V} w_{v} x_{vi} \leq C_i - L_i
+  // (L_i is the load of the modules already on cpu i, as in the heuristics)
   for (size_t i = 0; i < cpus.size(); i++)
     {
       Lp::Expr e;
       for (SmartDigraph::NodeIt n(g); n != INVALID; ++n)
   	e += module_weights[g.id(n)] * x[n][i];
-      mapping.addRow(e <= cpus[0].capacity());
+      mapping.addRow(e <= std::max(cpus[i].capacity() - cpus[i].load(), 0.0f));
     }
 
   // \phi(u,v) \ge x_{ui} - x_{vi}  \forall (u,v) \in A, \forall i \in N
@@ -103,30 +318,69 @@ EmbeddingResult embed_ilp(const SmartDigraph& g,
   	}
     }
 
-  // x_{ui} + x_{vi} \le 1 \forall (u,v) \in E
-  for (SmartGraph::EdgeIt e(cg); e != INVALID; ++e)
+  // \sum_{v \in K} x_{vi} \le 1 \forall K \in cliques(E), \forall i \in N
+  // (one row per conflict clique instead of one per conflicting pair)
+  ConflictCliques cliques = get_conflict_cliques(g, cg);
+  for (size_t k = 0; k < cliques.size(); ++k)
+    for (size_t i = 0; i < cpus.size(); i++)
+      {
+	Lp::Expr e;
+	for (const int* v = cliques.begin(k); v != cliques.end(k); ++v)
+	  e += x[g.nodeFromId(*v)][i];
+	mapping.addRow(e <= 1);
+      }
+
+  // topology: crossing the boundary of a core, NUMA node or socket costs
+  // the difference to the cost of the level below, on top of phi
+  // \psi_l(u,v) \ge \sum_{i \in G} (x_{ui} - x_{vi})
+  //   \forall (u,v) \in A, \forall G \in groups of level l
+  const Topology* topology = get_topology(cpus);
+  std::vector<std::pair<long, std::shared_ptr<SmartDigraph::ArcMap<LpBase::Col>>>> psi;
+  for (size_t l = Topology::CORE; topology != nullptr && l < Topology::LEVELS; ++l)
     {
-      SmartDigraph::Node n = g.nodeFromId(cg.id(cg.u(e)));
-      SmartDigraph::Node m = g.nodeFromId(cg.id(cg.v(e)));
+      long increment = topology->costs()[l] - topology->costs()[l-1];
+      std::map<size_t, std::vector<size_t>> groups;
       for (size_t i = 0; i < cpus.size(); i++)
-	{
-	  mapping.addRow((x[n][i] +  x[m][i]) <= 1);
-	}
+	groups[topology->groups(Topology::Level(l))[i]].push_back(i);
+      if (increment == 0 || groups.size() < 2)
+	continue;
+      auto psi_l = std::make_shared<SmartDigraph::ArcMap<LpBase::Col>>(g);
+      mapping.addColSet(*psi_l);
+      for (SmartDigraph::ArcIt a(g); a != INVALID; ++a)
+	for (const auto& group : groups)
+	  {
+	    Lp::Expr e;
+	    for (size_t i : group.second)
+	      e += x[g.source(a)][i] - x[g.target(a)][i];
+	    mapping.addRow(e <= (*psi_l)[a]);
+	  }
+      psi.push_back(std::make_pair(increment, psi_l));
     }
+  auto arc_cost = [&](SmartDigraph::Arc a) {
+    Lp::Expr e;
+    if (topology == nullptr)
+      e += phi[a];
+    else
+      e += topology->costs()[Topology::SMT] * phi[a];
+    for (const auto& p : psi)
+      e += p.first * (*p.second)[a];
+    return e;
+  };
 
   // objective func
   if (max_obj_func == true)
     {
       // \min \alpha:
-      // \alpha \ge \sum_{(u,v) \in p_f} \phi(u,v)    \forall f \in F
+      // \alpha \ge \hat{r}_c \sum_{(u,v) \in p_c} \phi(u,v)    \forall c \in C
+      // (flows of the same path p_c form a class c, \hat{r}_c is their largest rate)
       LpBase::Col alpha = mapping.addCol();
-      for (const auto& f : flows)
+      for (size_t c = 0; c < paths.size(); ++c)
 	{
 	  Lp::Expr flow_sum;
-	  for (size_t i = 0; i < f.modules().size()-1; i++)
+	  for (const int* it = paths.begin(c); it + 1 < paths.end(c); ++it)
 	    {
-	      flow_sum += phi[arclookup(f.modules()[i].node(),
-					f.modules()[i+1].node())];
+	      flow_sum += paths.peak_rate(c) * arc_cost(arclookup(g.nodeFromId(*it),
+								  g.nodeFromId(*(it+1))));
 	    }
 	  mapping.addRow(flow_sum <= alpha);
 	}
@@ -134,25 +388,87 @@ EmbeddingResult embed_ilp(const SmartDigraph& g,
     }
   else
     {
-      // \sum_{f\in F} \sum_{(u,v) \in p_f} \phi(u,v)
-      for (const auto& f : flows)
-	  for (size_t i = 0; i < f.modules().size()-1; i++)
+      // \sum_{c\in C} r_c \sum_{(u,v) \in p_c} \phi(u,v), or the topology cost
+      // (r_c is the total rate of the flows of class c)
+      for (size_t c = 0; c < paths.size(); ++c)
+	  for (const int* it = paths.begin(c); it + 1 < paths.end(c); ++it)
 	    // NB: segfault here if a module is missing from a flow
 	    // definition
-	    obj_func += phi[arclookup(f.modules()[i].node(),
-				      f.modules()[i+1].node())];
+	    obj_func += paths.rate(c) * arc_cost(arclookup(g.nodeFromId(*it),
+							  g.nodeFromId(*(it+1))));
     }
 
   mapping.min();
   mapping.obj(obj_func);
-  mapping.solve();
+  set_ilp_solver_params(mapping, opts);
+
+  // warm start: the heuristic mapping is passed to the solver as the
+  // starting values of x, its first incumbent; LEMON cannot pass a MIP
+  // start, so without a native interface it is only used as an objective
+  // cutoff; either way it is the fallback if the solver finds nothing
+  if (opts.mip_start != nullptr)
+    {
+      // with symmetry breaking, the identical cpus of the start are
+      // renumbered by the first module they host to satisfy its bounds
+      std::vector<size_t> label(cpus.size(), UNMAPPED);
+      size_t next_label = 0;
+      std::vector<LpBase::Col> start_cols;
+      std::vector<double> start_values;
+      for (SmartDigraph::NodeIt n(g); n != INVALID; ++n)
+	{
+	  size_t cpu = opts.mip_start->mapping[g.id(n)];
+	  if (symmetry_breaking == true)
+	    {
+	      if (label[cpu] == UNMAPPED)
+		label[cpu] = next_label++;
+	      cpu = label[cpu];
+	    }
+	  for (size_t i = 0; i < cpus.size(); i++)
+	    {
+	      start_cols.push_back(x[n][i]);
+	      start_values.push_back(cpu == i ? 1 : 0);
+	    }
+	}
+      if (set_ilp_solver_start(mapping, start_cols, start_values) == false)
+	mapping.addRow(obj_func <= opts.mip_start->sol_value);
+    }
 
   // mapping.write("/tmp/dfg.lp", "lp");
 
-  if (mapping.type() != Mip::OPTIMAL)
-    throw runtime_error("Optimal solution not found");
+  if (metrics().enabled())
+    {
+      long rows = 0, cols = 0;
+      for (LpBase::RowIt r(mapping); r != INVALID; ++r)
+	++rows;
+      for (LpBase::ColIt c(mapping); c != INVALID; ++c)
+	++cols;
+      metrics().add("ilp_rows", rows);
+      metrics().add("ilp_cols", cols);
+    }
+  metrics().add_phase("embed.ilp.build", elapsed_us(t_build));
+
+  auto t_solve = std::chrono::steady_clock::now();
+  mapping.solve();
+  metrics().add_phase("embed.ilp.solve", elapsed_us(t_solve));
+  if (get_ilp_solver_nodes(mapping) >= 0)
+    metrics().add("ilp_nodes", get_ilp_solver_nodes(mapping));
+
+  if (get_ilp_solver_incumbent(mapping) == false)
+    {
+      // no solution within the limits (without a native start, the
+      // cutoff excludes anything worse than the warm start): return the
+      // warm start
+      if (opts.mip_start == nullptr && mapping.type() == Mip::INFEASIBLE)
+	throw EmbeddingInfeasible("Embedding not possible: the ILP is infeasible");
+      if (opts.mip_start == nullptr)
+	throw runtime_error("Optimal solution not found");
+      EmbeddingResult retval = *opts.mip_start;
+      retval.gap = get_gap(retval.sol_value, get_ilp_solver_bound(mapping, lower_bound));
+      return retval;
+    }
 
   EmbeddingResult retval;
+  retval.mapping.assign(countNodes(g), UNMAPPED);
   for (SmartDigraph::NodeIt n(g); n != INVALID; ++n)
     {
       size_t cpu_id = 0;
@@ -160,7 +476,11 @@ EmbeddingResult embed_ilp(const SmartDigraph& g,
 	++cpu_id;
       retval.mapping[g.id(n)] = cpu_id;
     }
-  retval.sol_value = mapping.solValue();
+  retval.sol_value = std::lround(mapping.solValue());
+  if (mapping.type() == Mip::OPTIMAL && opts.mip_gap == 0)
+    retval.gap = 0;
+  else
+    retval.gap = get_gap(retval.sol_value, get_ilp_solver_bound(mapping, lower_bound));
   return retval;
 }
 
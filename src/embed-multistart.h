@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMBED_MULTISTART_H
+#define EMBED_MULTISTART_H
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "embed-common.h"
+
+
+// a randomized construction: builds one embedding from the given generator
+typedef std::function<EmbeddingResult(std::default_random_engine&)> RandomizedEmbedder;
+
+
+struct MultiStartStat
+{
+  std::vector<long> values;  // objective value per start, in start order
+  size_t failed = 0;  // starts that found no feasible embedding
+  size_t best_start = 0;
+  unsigned best_seed = 0;
+  size_t threads = 0;
+};
+
+
+inline EmbeddingResult embed_multistart(const RandomizedEmbedder& embed,
+					size_t starts,
+					unsigned seed,
+					size_t threads = 0,
+					MultiStartStat* stat = nullptr)
+{
+  // runs randomized constructions in parallel and keeps the best one;
+  // start i is seeded with seed + i, so the result does not depend on
+  // the number of threads
+  if (starts == 0)
+    throw std::runtime_error("Multi-start needs at least one start");
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, starts);
+
+  std::vector<EmbeddingResult> results(starts);
+  std::vector<char> ok(starts, false);
+  std::vector<std::exception_ptr> errors(starts);
+  std::atomic<size_t> next(0);
+
+  auto worker = [&]() {
+    size_t i;
+    while ((i = next++) < starts)
+      {
+	std::default_random_engine generator(seed + i);
+	try {
+	  results[i] = embed(generator);
+	  ok[i] = true;
+	} catch (...) {
+	  errors[i] = std::current_exception();
+	}
+      }
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t)
+    pool.push_back(std::thread(worker));
+  worker();
+  for (auto& t : pool)
+    t.join();
+
+  // best result, ties broken by the lower start index
+  MultiStartStat st;
+  st.threads = threads;
+  size_t best = starts;
+  for (size_t i = 0; i < starts; ++i)
+    {
+      if (ok[i] == false)
+	{
+	  ++st.failed;
+	  continue;
+	}
+      st.values.push_back(results[i].sol_value);
+      if (best == starts || results[i].sol_value < results[best].sol_value)
+	best = i;
+    }
+  if (best == starts)
+    std::rethrow_exception(errors[0]);
+
+  st.best_start = best;
+  st.best_seed = seed + best;
+  if (stat != nullptr)
+    *stat = st;
+
+  return results[best];
+}
+
+
+#endif  // EMBED_MULTISTART_H
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMBED_PRESOLVE_H
+#define EMBED_PRESOLVE_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "embed-common.h"
+#include "module.h"
+
+
+struct PresolveStat
+{
+  size_t min_cpus = 0;  // lower bound on the cpus needed
+  size_t largest_clique = 0;  // most modules needing pairwise different cpus
+  float total_weight = 0;
+  float total_capacity = 0;  // free capacity of the usable cpus
+};
+
+
+inline std::string _presolve_number(float x)
+{
+  std::ostringstream ss;
+  ss << x;
+  return ss.str();
+}
+
+
+inline std::string _presolve_names(const std::vector<int>& group,
+				   const std::vector<const Module*>& module_by_id,
+				   size_t max_names = 8)
+{
+  std::string retval;
+  for (size_t i = 0; i < group.size() && i < max_names; ++i)
+    retval += (i ? ", '" : "'") + module_by_id[group[i]]->name() + "'";
+  if (group.size() > max_names)
+    retval += ", ...";
+  return retval;
+}
+
+
+inline size_t _presolve_distinct_cpus(const std::vector<float>& weights,
+				      const std::vector<float>& free_caps)
+{
+  // modules of (decreasing) weights on pairwise different cpus of
+  // (decreasing) free capacities: possible iff the i-th heaviest fits on
+  // the i-th largest cpu; returns the first i that does not, or the
+  // number of modules if all do
+  for (size_t i = 0; i < weights.size(); ++i)
+    if (i >= free_caps.size() || weights[i] > free_caps[i] * (1 + 1e-6f))
+      return i;
+  return weights.size();
+}
+
+
+inline void presolve_instance(const lemon::SmartDigraph& g,
+			      const lemon::SmartGraph& cg,
+			      const std::vector<Cpu>& cpus,
+			      const std::vector<Module>& modules,
+			      const std::vector<size_t>& disabled_cpus = std::vector<size_t>(),
+			      PresolveStat* stat = nullptr)
+{
+  // cheap necessary conditions of feasibility, checked before embedding:
+  // every module fits on some cpu, the modules of each conflict clique
+  // and the modules too heavy to share any cpu fit on pairwise different
+  // cpus, and the total weight fits in the total free capacity; throws
+  // runtime_error with the violated condition, so infeasible instances
+  // are rejected in milliseconds instead of by the embedders
+  PresolveStat st;
+  std::vector<char> usable(cpus.size(), true);
+  for (size_t cpu : disabled_cpus)
+    if (cpu < cpus.size())
+      usable[cpu] = false;
+  std::vector<float> free_caps;
+  for (const auto& cpu : cpus)
+    if (usable[cpu.id()] == true)
+      free_caps.push_back(std::max(cpu.capacity() - cpu.load(), 0.0f));
+  std::sort(free_caps.begin(), free_caps.end(), std::greater<float>());
+  if (free_caps.empty())
+    throw EmbeddingInfeasible("Embedding not possible: no CPU available");
+  const float max_cap = free_caps[0];
+  st.total_capacity = std::accumulate(free_caps.begin(), free_caps.end(), 0.0f);
+
+  std::vector<const Module*> module_by_id(countNodes(g), nullptr);
+  std::vector<float> weights(countNodes(g), 0);
+  for (const auto& module : modules)
+    {
+      const int v = g.id(module.node());
+      module_by_id[v] = &module;
+      weights[v] = module.weight();
+      st.total_weight += module.weight();
+    }
+  auto by_weight = [&weights](int u, int v) { return weights[u] > weights[v]; };
+
+  // oversized modules
+  for (const auto& module : modules)
+    if (module.weight() > max_cap * (1 + 1e-6f))
+      throw EmbeddingInfeasible("Embedding not possible: module '" + module.name() +
+			        "' (weight " + _presolve_number(module.weight()) +
+			        ") does not fit on any CPU (largest free capacity " +
+			        _presolve_number(max_cap) + ")");
+
+  auto check_distinct = [&](std::vector<int>& group, const std::string& what) {
+    std::sort(group.begin(), group.end());
+    std::stable_sort(group.begin(), group.end(), by_weight);
+    std::vector<float> group_weights;
+    for (int v : group)
+      group_weights.push_back(weights[v]);
+    size_t i = _presolve_distinct_cpus(group_weights, free_caps);
+    if (i == group.size())
+      return;
+    if (i >= free_caps.size())
+      throw EmbeddingInfeasible("Embedding not possible: " + std::to_string(group.size()) +
+			        " " + what + " (" + _presolve_names(group, module_by_id) +
+			        ") need as many different CPUs, only " +
+			        std::to_string(free_caps.size()) + " available");
+    throw EmbeddingInfeasible("Embedding not possible: " + std::to_string(group.size()) +
+			      " " + what + " (" + _presolve_names(group, module_by_id) +
+			      ") need different CPUs, but only " + std::to_string(i) +
+			      " CPUs have a free capacity of at least " +
+			      _presolve_number(weights[group[i]]));
+  };
+
+  // conflict cliques, over the modules to embed
+  ConflictCliques cliques = get_conflict_cliques(g, cg);
+  std::vector<int> group;
+  for (size_t k = 0; k < cliques.size(); ++k)
+    {
+      group.clear();
+      for (const int* v = cliques.begin(k); v != cliques.end(k); ++v)
+	if (module_by_id[*v] != nullptr)
+	  group.push_back(*v);
+      st.largest_clique = std::max(st.largest_clique, group.size());
+      check_distinct(group, "mutually conflicting modules");
+    }
+
+  // modules heavier than half of the largest free capacity share no cpu
+  group.clear();
+  for (const auto& module : modules)
+    if (module.weight() > max_cap / 2 * (1 + 1e-6f))
+      group.push_back(g.id(module.node()));
+  if (group.size() > 1)
+    check_distinct(group, "modules heavier than half of the largest free CPU capacity");
+
+  // bin packing bound: even cpus of the largest free capacity hold at
+  // most max_cap of weight each
+  st.min_cpus = std::max(st.largest_clique, group.size());
+  if (max_cap > 0)
+    st.min_cpus = std::max(st.min_cpus, (size_t) std::ceil(st.total_weight / max_cap *
+							   (1 - 1e-6f)));
+  if (st.total_weight > st.total_capacity * (1 + 1e-6f))
+    throw EmbeddingInfeasible("Embedding not possible: total module weight " +
+			      _presolve_number(st.total_weight) +
+			      " exceeds the free capacity of the CPUs (" +
+			      _presolve_number(st.total_capacity) + "), at least " +
+			      std::to_string(st.min_cpus) + " CPUs of capacity " +
+			      _presolve_number(max_cap) + " needed");
+
+  if (stat != nullptr)
+    *stat = st;
+}
+
+
+#endif  // EMBED_PRESOLVE_H
@@ -24,103 +24,123 @@
 #include "cpu.h"
 #include "embed-common.h"
 #include "flow.h"
+#include "metrics.h"
 #include "utils.h"
 
 using namespace lemon;
 
 
-EmbeddingResult _embed_random_conflictfree(const SmartDigraph& g,
-					   const SmartGraph& cg,
-					   const std::vector<Cpu>& cpus,
-					   const std::vector<Flow>& flows,
-					   const std::vector<Module>& modules,
-					   bool max_obj_func = false)
+inline EmbeddingResult _embed_random_conflictfree(const SmartDigraph& g,
+						  const SmartGraph& cg,
+						  const std::vector<Cpu>& cpus,
+						  const std::vector<Flow>& flows,
+						  const std::vector<Module>& modules,
+						  bool max_obj_func,
+						  std::default_random_engine& generator)
 {
-  std::random_device rd;
-  std::default_random_engine generator(rd());
-  std::uniform_int_distribution<size_t> distribution(0, cpus.size()-1);
-
   EmbeddingResult retval;
+  retval.mapping.assign(countNodes(g), UNMAPPED);
+
+  std::vector<float> cpu_loads;
+  for (const auto& cpu : cpus)
+    cpu_loads.push_back(cpu.load());
 
   for (const auto& module : modules)
-      retval.mapping[g.id(module.node())] = distribution(generator);
+    {
+      std::vector<const Cpu*> available_cpus;
+      for (const auto& cpu : cpus)
+	if (cpu_loads[cpu.id()] + module.weight() <= cpu.capacity())
+	  available_cpus.push_back(&cpu);
 
-  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func);
+      if (available_cpus.size() == 0 )
+	    throw EmbeddingInfeasible("Embedding not possible: out of available CPUs");
+
+      std::uniform_int_distribution<size_t> distribution(0, available_cpus.size()-1);
+      size_t cpu_id = available_cpus[distribution(generator)]->id();
+      retval.mapping[g.id(module.node())] = cpu_id;
+      cpu_loads[cpu_id] += module.weight();
+    }
+
+  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func,
+					get_topology(cpus));
 
   return retval;
 }
 
 
-EmbeddingResult _embed_random_conflicts(const SmartDigraph& g,
-					const SmartGraph& cg,
-					const std::vector<Cpu>& cpus,
-					const std::vector<Flow>& flows,
-					const std::vector<Module>& modules,
-					bool max_obj_func = false)
+inline EmbeddingResult _embed_random_conflicts(const SmartDigraph& g,
+					       const SmartGraph& cg,
+					       const std::vector<Cpu>& cpus,
+					       const std::vector<Flow>& flows,
+					       const std::vector<Module>& modules,
+					       bool max_obj_func,
+					       std::default_random_engine& generator)
 {
-  std::random_device rd;
-  std::default_random_engine generator(rd());
-
   EmbeddingResult retval;
 
-  for (const auto& module : modules)
-    // init retval.mapping to a probably invalid value
-    retval.mapping[g.id(module.node())] = -1;
+  retval.mapping.assign(countNodes(g), UNMAPPED);
+
+  std::vector<float> cpu_loads;
+  for (const auto& cpu : cpus)
+    cpu_loads.push_back(cpu.load());
+
+  ConflictCliques cliques = get_conflict_cliques(g, cg);
+  CpuConflictMask conflict_mask(cliques, g, cpus);
 
   for (const auto& module : modules)
     {
       std::vector<const Cpu*> available_cpus;
-      std::set<int> conflict_ids = get_conflict_ids(module, g, cg);
-
-      for (const auto& cpu : cpus)
-	{
-	  bool no_go = false;
-	  for (const auto& c : conflict_ids)
-	    if (retval.mapping[c] == cpu.id())
-	      {
-		no_go = true;
-		break;
-	      }
-
-	  if (no_go == false)
-	    {
-	      if (cpu.modules().size() == 0)
-		available_cpus.push_back(&cpu);
-	      else
-		for (const auto& cpu_module : cpu.modules())
-		  if (conflict_ids.find(g.id(cpu_module.node())) == conflict_ids.end())
-		    // no conflicting module on cpu,
-		    if (cpu.load() + module.weight() <= cpu.capacity())
-		      // enough resource is available,
-		      // cpu is free to use
-		      available_cpus.push_back(&cpu);
-	    }
-	}
+      conflict_mask.for_each_eligible(g.id(module.node()), [&](size_t cpu_id) {
+	  // no conflicting module on cpu,
+	  if (cpu_loads[cpu_id] + module.weight() <= cpus[cpu_id].capacity())
+	    // enough resource is available,
+	    // cpu is free to use
+	    available_cpus.push_back(&cpus[cpu_id]);
+	});
 
       if (available_cpus.size() == 0 )
-	    throw runtime_error("Embedding not possible: out of available CPUs");
+	    throw EmbeddingInfeasible("Embedding not possible: out of available CPUs");
 
       std::uniform_int_distribution<size_t> distribution(0, available_cpus.size()-1);
-      retval.mapping[g.id(module.node())] = available_cpus[distribution(generator)]->id();
+      size_t cpu_id = available_cpus[distribution(generator)]->id();
+      retval.mapping[g.id(module.node())] = cpu_id;
+      cpu_loads[cpu_id] += module.weight();
+      conflict_mask.place(g.id(module.node()), cpu_id);
     }
+  metrics().add("conflict_checks", conflict_mask.checks());
 
-  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func);
+  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func,
+					get_topology(cpus));
 
   return retval;
 }
 
 
-EmbeddingResult embed_random(const SmartDigraph& g,
-			     const SmartGraph& cg,
-			     const std::vector<Cpu>& cpus,
-			     const std::vector<Flow>& flows,
-			     const std::vector<Module>& modules,
-			     bool max_obj_func = false)
+inline EmbeddingResult embed_random(const SmartDigraph& g,
+				    const SmartGraph& cg,
+				    const std::vector<Cpu>& cpus,
+				    const std::vector<Flow>& flows,
+				    const std::vector<Module>& modules,
+				    bool max_obj_func,
+				    std::default_random_engine& generator)
 {
   if (countEdges(cg) == 0)
-    return _embed_random_conflictfree(g, cg, cpus, flows, modules, max_obj_func);
+    return _embed_random_conflictfree(g, cg, cpus, flows, modules, max_obj_func, generator);
   else
-    return _embed_random_conflicts(g, cg, cpus, flows, modules, max_obj_func);
+    return _embed_random_conflicts(g, cg, cpus, flows, modules, max_obj_func, generator);
+}
+
+
+inline EmbeddingResult embed_random(const SmartDigraph& g,
+				    const SmartGraph& cg,
+				    const std::vector<Cpu>& cpus,
+				    const std::vector<Flow>& flows,
+				    const std::vector<Module>& modules,
+				    bool max_obj_func = false)
+{
+  std::random_device rd;
+  std::default_random_engine generator(rd());
+  return embed_random(g, cg, cpus, flows, modules, max_obj_func, generator);
 }
 
 
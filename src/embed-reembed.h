@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMBED_REEMBED_H
+#define EMBED_REEMBED_H
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "embed-common.h"
+#include "flow.h"
+#include "module.h"
+
+using namespace lemon;
+
+
+struct ReembedOptions
+{
+  std::vector<size_t> failed;  // failed or removed cpus
+  long budget = 0;  // modules on surviving cpus that may be migrated
+  long time_limit_ms = 100;  // of the improvement phase
+};
+
+
+struct ReembedStat
+{
+  size_t displaced = 0;  // modules on failed cpus
+  size_t migrated = 0;  // modules moved off a surviving cpu
+  long previous_value = 0;  // objective of the mapping before the failure
+};
+
+
+inline std::vector<char> get_alive_cpus(size_t cpu_num, const std::vector<size_t>& failed)
+{
+  std::vector<char> alive(cpu_num, true);
+  for (size_t cpu : failed)
+    {
+      if (cpu >= cpu_num)
+	throw std::runtime_error("Re-embedding not possible: unknown cpu " +
+				 std::to_string(cpu));
+      alive[cpu] = false;
+    }
+  if (std::find(alive.begin(), alive.end(), true) == alive.end())
+    throw EmbeddingInfeasible("Re-embedding not possible: no cpu left");
+  return alive;
+}
+
+
+inline EmbeddingResult repair_embedding(const SmartDigraph& g,
+					const SmartGraph& cg,
+					const std::vector<Cpu>& cpus,
+					const std::vector<Flow>& flows,
+					const std::vector<Module>& modules,
+					const std::vector<size_t>& previous,
+					bool max_obj_func = false,
+					const ReembedOptions& opts = ReembedOptions(),
+					ReembedStat* stat = nullptr)
+{
+  // remaps the modules of failed cpus onto the surviving ones, keeping
+  // every other module in place except for at most opts.budget
+  // migrations that make room or reduce crossings
+  const size_t node_num = countNodes(g);
+  if (previous.size() != node_num)
+    throw std::runtime_error("Re-embedding not possible: incomplete mapping");
+  std::vector<char> alive = get_alive_cpus(cpus.size(), opts.failed);
+
+  FlowPaths paths(g, flows);
+  // displaced modules are unmapped until placed, so the delta of placing
+  // one counts its arcs to the modules already placed
+  std::vector<size_t> start = previous;
+  for (size_t v = 0; v < node_num; ++v)
+    if (alive[previous[v]] == false)
+      start[v] = UNMAPPED;
+  DeltaEvaluator eval(g, cpus, modules, paths, start);
+  Adjacency conflicts = get_conflict_adjacency(g, cg);
+  std::vector<std::pair<int, int>> arcs;
+  for (SmartDigraph::ArcIt a(g); a != INVALID; ++a)
+    arcs.push_back(std::make_pair(g.id(g.source(a)), g.id(g.target(a))));
+  Adjacency dfg_adj(node_num, arcs);
+
+  ReembedStat st;
+  st.previous_value = get_flow_crossings(previous, paths, max_obj_func, get_topology(cpus));
+
+  // the selected objective, ties broken by the sum with -maxflow
+  const DeltaEvaluator::Energy zero(0, 0);
+  auto energy = [&](const DeltaEvaluator::Delta& d) {
+    return d.energy(max_obj_func);
+  };
+  auto can_move = [&](size_t v, size_t cpu, size_t ignore = UNMAPPED) {
+    return alive[cpu] && cpu != eval.mapping()[v] && eval.move_fits(v, cpu) &&
+      no_conflict_on_cpu(conflicts, eval.mapping(), v, cpu, ignore);
+  };
+  // migrations of modules that were on a surviving cpu
+  long migrated = 0;
+  auto migration_cost = [&](size_t v, size_t cpu) {
+    if (alive[previous[v]] == false)
+      return 0;
+    return int(cpu != previous[v]) - int(eval.mapping()[v] != previous[v]);
+  };
+
+  // modules by cpu, appended to on every move; entries of modules that
+  // have left the cpu since are skipped
+  std::vector<std::vector<size_t>> hosted(cpus.size());
+  for (size_t v = 0; v < node_num; ++v)
+    if (eval.mapping()[v] != UNMAPPED)
+      hosted[eval.mapping()[v]].push_back(v);
+  auto move = [&](size_t v, size_t cpu) {
+    eval.move(v, cpu);
+    hosted[cpu].push_back(v);
+  };
+
+  // the alive cpus with the most free capacity, and those of the flow
+  // neighbours of a module: the candidates of the make-room search
+  const size_t room_cpus = 8;
+  const size_t room_modules = 64;
+  std::vector<size_t> alive_cpus;
+  for (size_t cpu = 0; cpu < cpus.size(); ++cpu)
+    if (alive[cpu] == true)
+      alive_cpus.push_back(cpu);
+  auto freest_cpus = [&]() {
+    std::vector<size_t> freest = alive_cpus;
+    size_t k = std::min(room_cpus, freest.size());
+    std::partial_sort(freest.begin(), freest.begin() + k, freest.end(), [&](size_t a, size_t b) {
+	return eval.capacity(a) - eval.loads()[a] > eval.capacity(b) - eval.loads()[b];
+      });
+    freest.resize(k);
+    return freest;
+  };
+  auto add_neighbour_cpus = [&](size_t v, std::vector<size_t>& list) {
+    for (const int* w = dfg_adj.begin(v); w != dfg_adj.end(v); ++w)
+      {
+	size_t cpu = eval.mapping()[*w];
+	if (cpu != UNMAPPED && alive[cpu] == true &&
+	    std::find(list.begin(), list.end(), cpu) == list.end())
+	  list.push_back(cpu);
+      }
+  };
+
+  std::vector<size_t> displaced;
+  for (size_t v = 0; v < node_num; ++v)
+    if (eval.mapping()[v] == UNMAPPED)
+      displaced.push_back(v);
+  st.displaced = displaced.size();
+  std::stable_sort(displaced.begin(), displaced.end(), [&](size_t a, size_t b) {
+      return eval.weight(a) > eval.weight(b);
+    });
+
+  // place displaced modules, heaviest first, where they add the fewest
+  // crossings
+  for (size_t v : displaced)
+    {
+      size_t best = UNMAPPED;
+      DeltaEvaluator::Energy best_energy = zero;
+      for (size_t cpu = 0; cpu < cpus.size(); ++cpu)
+	{
+	  if (can_move(v, cpu) == false)
+	    continue;
+	  DeltaEvaluator::Energy e = energy(eval.move_delta(v, cpu));
+	  if (best == UNMAPPED || e < best_energy)
+	    {
+	      best = cpu;
+	      best_energy = e;
+	    }
+	}
+      if (best != UNMAPPED)
+	{
+	  move(v, best);
+	  continue;
+	}
+
+      // no room: migrate a module u to another cpu, if the budget allows,
+      // to make room for v; u is a flow neighbour of v or one of the
+      // first modules on the freest cpus and the cpus of v's neighbours,
+      // and goes to one of the freest cpus or to a cpu of its neighbours;
+      // only if none of them makes room are all (u, cpu) pairs tried
+      best_energy = zero;
+      size_t best_u = UNMAPPED, best_u_cpu = UNMAPPED;
+      const std::vector<size_t> freest = freest_cpus();
+      auto try_room = [&](size_t u, const std::vector<size_t>& u_cpus) {
+	size_t cpu = eval.mapping()[u];
+	if (cpu == UNMAPPED || alive[cpu] == false ||
+	    eval.loads()[cpu] - eval.weight(u) + eval.weight(v) > eval.capacity(cpu) ||
+	    no_conflict_on_cpu(conflicts, eval.mapping(), v, cpu, u) == false)
+	  return false;
+	for (size_t u_cpu : u_cpus)
+	  {
+	    if (migrated + migration_cost(u, u_cpu) > opts.budget ||
+		can_move(u, u_cpu) == false)
+	      continue;
+	    DeltaEvaluator::Energy e = energy(eval.move_delta(u, u_cpu));
+	    if (best_u == UNMAPPED || e < best_energy)
+	      {
+		best_u = u;
+		best_u_cpu = u_cpu;
+		best_energy = e;
+	      }
+	  }
+	return true;
+      };
+      auto try_room_near = [&](size_t u) {
+	std::vector<size_t> u_cpus = freest;
+	add_neighbour_cpus(u, u_cpus);
+	return try_room(u, u_cpus);
+      };
+
+      for (const int* u = dfg_adj.begin(v); u != dfg_adj.end(v); ++u)
+	try_room_near(*u);
+      std::vector<size_t> room = freest;
+      add_neighbour_cpus(v, room);
+      for (size_t cpu : room)
+	{
+	  size_t tried = 0;
+	  for (size_t k = 0; k < hosted[cpu].size() && tried < room_modules; ++k)
+	    {
+	      size_t u = hosted[cpu][k];
+	      if (eval.mapping()[u] == cpu && try_room_near(u) == true)
+		++tried;
+	    }
+	}
+      if (best_u == UNMAPPED)
+	for (size_t u = 0; u < node_num; ++u)
+	  try_room(u, alive_cpus);
+      if (best_u == UNMAPPED)
+	throw EmbeddingInfeasible("Re-embedding not possible: displaced modules do not fit "
+				  "the remaining cpus within the migration budget");
+      size_t cpu = eval.mapping()[best_u];
+      migrated += migration_cost(best_u, best_u_cpu);
+      move(best_u, best_u_cpu);
+      move(v, cpu);
+    }
+
+  // improve around the displaced modules: they move freely, others only
+  // within the budget
+  const auto t_deadline = std::chrono::steady_clock::now() +
+    std::chrono::milliseconds(opts.time_limit_ms);
+  std::vector<char> in_scope(node_num, false);
+  std::vector<size_t> scope;
+  auto add_scope = [&](size_t v) {
+    if (in_scope[v] == false)
+      {
+	in_scope[v] = true;
+	scope.push_back(v);
+      }
+  };
+  for (size_t v : displaced)
+    {
+      add_scope(v);
+      for (const int* w = dfg_adj.begin(v); w != dfg_adj.end(v); ++w)
+	add_scope(*w);
+    }
+
+  bool improved = true;
+  while (improved == true && std::chrono::steady_clock::now() < t_deadline)
+    {
+      improved = false;
+      for (size_t k = 0; k < scope.size(); ++k)
+	{
+	  size_t v = scope[k];
+	  size_t best = UNMAPPED;
+	  DeltaEvaluator::Energy best_energy = zero;
+	  for (size_t cpu = 0; cpu < cpus.size(); ++cpu)
+	    {
+	      if (migrated + migration_cost(v, cpu) > opts.budget || can_move(v, cpu) == false)
+		continue;
+	      DeltaEvaluator::Energy e = energy(eval.move_delta(v, cpu));
+	      if (e < best_energy)
+		{
+		  best = cpu;
+		  best_energy = e;
+		}
+	    }
+	  if (best == UNMAPPED)
+	    continue;
+	  migrated += migration_cost(v, best);
+	  move(v, best);
+	  improved = true;
+	  for (const int* w = dfg_adj.begin(v); w != dfg_adj.end(v); ++w)
+	    add_scope(*w);
+	}
+    }
+
+  EmbeddingResult retval;
+  retval.mapping = eval.mapping();
+  retval.sol_value = get_flow_crossings(retval.mapping, paths, max_obj_func,
+					get_topology(cpus));
+  st.migrated = migrated;
+  if (stat != nullptr)
+    *stat = st;
+  return retval;
+}
+
+
+#endif  // EMBED_REEMBED_H
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMBED_REFINE_H
+#define EMBED_REFINE_H
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "embed-common.h"
+#include "flow.h"
+
+using namespace lemon;
+
+
+struct RefineOptions
+{
+  // local search budget; the search stops at whichever limit is hit first
+  long iterations = 1000000;
+  long time_limit_ms = 100;
+  unsigned seed = 0;
+};
+
+
+struct RefineStat
+{
+  long initial_value = 0;
+  long final_value = 0;
+  long iterations = 0;
+  long accepted = 0;
+};
+
+
+inline EmbeddingResult refine_embedding(const SmartDigraph& g,
+					const SmartGraph& cg,
+					const std::vector<Cpu>& cpus,
+					const std::vector<Flow>& flows,
+					const std::vector<Module>& modules,
+					const EmbeddingResult& start,
+					bool max_obj_func = false,
+					const RefineOptions& opts = RefineOptions(),
+					RefineStat* stat = nullptr)
+{
+  // simulated annealing over capacity- and conflict-respecting
+  // single module moves and pairwise swaps
+  const size_t node_num = countNodes(g);
+  if (start.mapping.size() != node_num)
+    throw std::runtime_error("Refinement not possible: incomplete mapping");
+
+  FlowPaths paths(g, flows);
+  DeltaEvaluator eval(g, cpus, modules, paths, start.mapping);
+
+  std::vector<std::pair<int, int>> arcs;
+  for (SmartDigraph::ArcIt a(g); a != INVALID; ++a)
+    arcs.push_back(std::make_pair(g.id(g.source(a)), g.id(g.target(a))));
+  Adjacency dfg_adj(node_num, arcs);
+  Adjacency conflicts = get_conflict_adjacency(g, cg);
+
+  // only weighs the max against the sum when annealing uphill moves, the
+  // best mapping is always chosen lexicographically
+  const long max_w = paths.flow_num() + 1;
+
+  std::default_random_engine generator(opts.seed);
+  std::uniform_int_distribution<size_t> rnd_module(0, node_num - 1);
+  std::uniform_int_distribution<size_t> rnd_cpu(0, cpus.size() - 1);
+  std::uniform_real_distribution<double> rnd_unit(0.0, 1.0);
+
+  // uphill energy of a delta: the max scaled by max_w plus the sum
+  auto uphill = [&](const DeltaEvaluator::Delta& d)
+    {
+      return max_obj_func ? double(d.max) * max_w + d.sum : double(d.sum);
+    };
+
+  // the temperature range is relative to the mean |delta| of a sample of
+  // random moves, flow rates and topology costs scale the deltas up
+  double scale = 0.0;
+  long sampled = 0;
+  for (int k = 0; node_num > 0 && cpus.size() > 1 && k < 256; ++k)
+    {
+      size_t v = rnd_module(generator);
+      size_t cpu = rnd_cpu(generator);
+      if (cpu == eval.mapping()[v])
+	continue;
+      double d = std::abs(uphill(eval.move_delta(v, cpu)));
+      if (d > 0)
+	{
+	  scale += d;
+	  ++sampled;
+	}
+    }
+  scale = (sampled > 0) ? scale / sampled : 1.0;
+
+  // geometric cooling from t_start to t_end over the budget, the
+  // iterations or the time limit, whichever runs out first
+  const double t_start = 0.2 * scale;
+  const double t_end = 0.005 * scale;
+  const double cooling = std::pow(t_end / t_start, 1.0 / std::max(opts.iterations, 1L));
+  double temperature = t_start;
+
+  const auto t_begin = std::chrono::steady_clock::now();
+  const auto t_deadline = t_begin + std::chrono::milliseconds(opts.time_limit_ms);
+
+  // energy: the selected objective, ties broken by the sum with -maxflow;
+  // the best energy is recorded on every improvement, the best mapping is
+  // the current one minus an undo log of the moves made since, copied out
+  // only once the log grows longer than the mapping
+  DeltaEvaluator::Energy best_energy = eval.energy(max_obj_func);
+  std::vector<size_t> best_mapping;
+  std::vector<std::pair<size_t, size_t>> undo;
+  bool logging = true;
+
+  RefineStat st;
+  st.initial_value = eval.value(max_obj_func);
+
+  for (long it = 0; node_num > 0 && cpus.size() > 1 && it < opts.iterations; ++it)
+    {
+      if ((it & 1023) == 0)
+	{
+	  auto now = std::chrono::steady_clock::now();
+	  if (now > t_deadline)
+	    break;
+	  double elapsed = std::chrono::duration<double, std::milli>(now - t_begin).count();
+	  double progress = std::max(double(it) / std::max(opts.iterations, 1L),
+				     elapsed / std::max(opts.time_limit_ms, 1L));
+	  temperature = t_start * std::pow(t_end / t_start, std::min(progress, 1.0));
+	}
+      ++st.iterations;
+      temperature *= cooling;
+
+      size_t v = rnd_module(generator);
+      size_t v_cpu = eval.mapping()[v];
+
+      // pick a flow neighbour of v (if any) to steer the move
+      size_t w = UNMAPPED;
+      if (dfg_adj.degree(v) > 0 && rnd_unit(generator) < 0.8)
+	w = dfg_adj.begin(v)[generator() % dfg_adj.degree(v)];
+
+      DeltaEvaluator::Delta d;
+      size_t u = UNMAPPED;
+      size_t target = UNMAPPED;
+      if (rnd_unit(generator) < 0.5)
+	{
+	  // move v next to its neighbour, or to a random cpu
+	  target = (w != UNMAPPED) ? eval.mapping()[w] : rnd_cpu(generator);
+	  if (target == v_cpu || !eval.move_fits(v, target) ||
+	      !no_conflict_on_cpu(conflicts, eval.mapping(), v, target))
+	    continue;
+	  d = eval.move_delta(v, target);
+	}
+      else
+	{
+	  // swap v with a module sitting next to its neighbour, or with a
+	  // random module
+	  if (w != UNMAPPED && eval.mapping()[w] != v_cpu)
+	    {
+	      size_t x = dfg_adj.begin(w)[generator() % dfg_adj.degree(w)];
+	      if (x != v && eval.mapping()[x] == eval.mapping()[w])
+		u = x;
+	    }
+	  if (u == UNMAPPED)
+	    u = rnd_module(generator);
+	  size_t u_cpu = eval.mapping()[u];
+	  if (u == v || u_cpu == v_cpu || !eval.swap_fits(u, v) ||
+	      !no_conflict_on_cpu(conflicts, eval.mapping(), v, u_cpu, u) ||
+	      !no_conflict_on_cpu(conflicts, eval.mapping(), u, v_cpu, v))
+	    continue;
+	  d = eval.swap_delta(u, v);
+	}
+
+      // downhill is lexicographic, uphill moves are annealed
+      DeltaEvaluator::Energy d_energy = d.energy(max_obj_func);
+      if (d_energy <= DeltaEvaluator::Energy(0, 0) ||
+	  rnd_unit(generator) < std::exp(-uphill(d) / temperature))
+	{
+	  if (logging)
+	    {
+	      undo.push_back(std::make_pair(v, v_cpu));
+	      if (u != UNMAPPED)
+		undo.push_back(std::make_pair(u, eval.mapping()[u]));
+	    }
+	  if (u == UNMAPPED)
+	    eval.move(v, target);
+	  else
+	    eval.swap(u, v);
+	  ++st.accepted;
+
+	  if (eval.energy(max_obj_func) < best_energy)
+	    {
+	      best_energy = eval.energy(max_obj_func);
+	      undo.clear();
+	      logging = true;
+	    }
+	  else if (logging && undo.size() > node_num)
+	    {
+	      best_mapping = eval.mapping();
+	      for (auto rit = undo.rbegin(); rit != undo.rend(); ++rit)
+		best_mapping[rit->first] = rit->second;
+	      undo.clear();
+	      logging = false;
+	    }
+	}
+    }
+
+  EmbeddingResult retval;
+  if (logging)
+    {
+      retval.mapping = eval.mapping();
+      for (auto rit = undo.rbegin(); rit != undo.rend(); ++rit)
+	retval.mapping[rit->first] = rit->second;
+    }
+  else
+    retval.mapping = best_mapping;
+  retval.sol_value = get_flow_crossings(retval.mapping, paths, max_obj_func,
+					get_topology(cpus));
+
+  st.final_value = retval.sol_value;
+  if (stat != nullptr)
+    *stat = st;
+
+  return retval;
+}
+
+
+#endif  // EMBED_REFINE_H
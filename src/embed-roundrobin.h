@@ -24,98 +24,118 @@
 #include "cpu.h"
 #include "embed-common.h"
 #include "flow.h"
+#include "metrics.h"
 #include "utils.h"
 
 using namespace lemon;
 
 
-EmbeddingResult _embed_rr_conflictfree(const SmartDigraph& g,
-				       const SmartGraph& cg,
-				       const std::vector<Cpu>& cpus,
-				       const std::vector<Flow>& flows,
-				       const std::vector<Module>& modules,
-				       bool max_obj_func = false)
+inline EmbeddingResult _embed_rr_conflictfree(const SmartDigraph& g,
+					      const SmartGraph& cg,
+					      const std::vector<Cpu>& cpus,
+					      const std::vector<Flow>& flows,
+					      const std::vector<Module>& modules,
+					      bool max_obj_func = false)
 {
   EmbeddingResult retval;
+  retval.mapping.assign(countNodes(g), UNMAPPED);
   size_t idx = 0;
 
+  std::vector<float> cpu_loads;
+  for (const auto& cpu : cpus)
+    cpu_loads.push_back(cpu.load());
+
+  size_t scanned = 0;
   for (const auto& module : modules)
     {
-      retval.mapping[g.id(module.node())] = idx;
+      // next cpu with enough resource
+      size_t start_idx = idx;
+      ++scanned;
+      while (cpu_loads[idx] + module.weight() > cpus[idx].capacity())
+	{
+	  ++scanned;
+	  idx = (idx + 1) % cpus.size();
+	  if (idx == start_idx)
+	    throw EmbeddingInfeasible("Embedding not possible: out of available CPUs");
+	}
+      retval.mapping[g.id(module.node())] = cpus[idx].id();
+      cpu_loads[idx] += module.weight();
       idx = (idx + 1) % cpus.size();
     }
+  metrics().add("bins_scanned", scanned);
 
-  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func);
+  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func,
+					get_topology(cpus));
 
   return retval;
 }
 
 
-EmbeddingResult _embed_rr_conflicts(const SmartDigraph& g,
-				    const SmartGraph& cg,
-				    const std::vector<Cpu>& cpus,
-				    const std::vector<Flow>& flows,
-				    const std::vector<Module>& modules,
-				    bool max_obj_func = false)
+inline EmbeddingResult _embed_rr_conflicts(const SmartDigraph& g,
+					   const SmartGraph& cg,
+					   const std::vector<Cpu>& cpus,
+					   const std::vector<Flow>& flows,
+					   const std::vector<Module>& modules,
+					   bool max_obj_func = false)
 {
   EmbeddingResult retval;
   size_t idx = 0;
-  for (const auto& module : modules)
-    // init retval.mapping to a probably invalid value
-    retval.mapping[g.id(module.node())] = -1;
+  retval.mapping.assign(countNodes(g), UNMAPPED);
 
+  ConflictCliques cliques = get_conflict_cliques(g, cg);
+  CpuConflictMask conflict_mask(cliques, g, cpus);
+
+  std::vector<float> cpu_loads;
+  for (const auto& cpu : cpus)
+    cpu_loads.push_back(cpu.load());
+
+  size_t scanned = 0;
   for (const auto& module : modules)
     {
       size_t start_idx = idx;
       bool done = false;
-      std::set<int> conflict_ids = get_conflict_ids(module, g, cg);
       while(done == false)
 	{
-	  bool no_go = false;
-	  for (const auto& c : conflict_ids)
-	    if (retval.mapping[c] == cpus[idx].id())
-	      {
-		no_go = true;
-		break;
-	      }
-
-	  if (cpus[idx].load() + module.weight() > cpus[idx].capacity())
+	  ++scanned;
+	  // conflicting module on cpu,
+	  // cpu is not free to use
+	  bool no_go = conflict_mask.blocked(g.id(module.node()), cpus[idx].id());
+
+	  if (cpu_loads[idx] + module.weight() > cpus[idx].capacity())
 	    // not enough resource,
 	    // cpu is not free to use
 	    no_go = true;
 
-	  if (no_go == false)
-	    for (const auto& cpu_module : cpus[idx].modules())
-	      if (conflict_ids.find(g.id(cpu_module.node())) != conflict_ids.end())
-		// conflicting module on cpu,
-		// cpu is not free to use
-		no_go = true;
-
 	  if (no_go == false)
 	    {
 	      retval.mapping[g.id(module.node())] = cpus[idx].id();
+	      conflict_mask.place(g.id(module.node()), cpus[idx].id());
+	      cpu_loads[idx] += module.weight();
 	      done = true;
 	    }
 
 	  idx = (idx + 1) % cpus.size();
 
-	  if (idx == start_idx)
-	    throw runtime_error("Embedding not possible: out of available CPUs");
+	  if (done == false && idx == start_idx)
+	    throw EmbeddingInfeasible("Embedding not possible: out of available CPUs");
 	}
     }
+  metrics().add("bins_scanned", scanned);
+  metrics().add("conflict_checks", conflict_mask.checks());
 
-  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func);
+  retval.sol_value = get_flow_crossings(g, retval.mapping, flows, max_obj_func,
+					get_topology(cpus));
 
   return retval;
 }
 
 
-EmbeddingResult embed_roundrobin(const SmartDigraph& g,
-				 const SmartGraph& cg,
-				 const std::vector<Cpu>& cpus,
-				 const std::vector<Flow>& flows,
-				 const std::vector<Module>& modules,
-				 bool max_obj_func = false)
+inline EmbeddingResult embed_roundrobin(const SmartDigraph& g,
+					const SmartGraph& cg,
+					const std::vector<Cpu>& cpus,
+					const std::vector<Flow>& flows,
+					const std::vector<Module>& modules,
+					bool max_obj_func = false)
 {
  if (countEdges(cg) == 0)
     return _embed_rr_conflictfree(g, cg, cpus, flows, modules, max_obj_func);
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The embedding dispatch of embed.h: compiled once into libdfgembed,
+// which dfg-embed and the library interface of dfgembed.h both call.
+
+#include "embed.h"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+using namespace lemon;
+
+
+static std::vector<Cpu> _disable_cpus(const std::vector<Cpu>& cpus,
+				      const std::vector<size_t>& disabled,
+				      float capacity)
+{
+  // a copy of the cpus with the disabled ones set to the given capacity
+  std::vector<Cpu> retval = cpus;
+  for (size_t cpu : disabled)
+    {
+      if (cpu >= cpus.size())
+	throw std::runtime_error("Embedding not possible: unknown cpu " +
+				 std::to_string(cpu));
+      retval[cpu] = Cpu(cpu, capacity);
+      retval[cpu].set_topology(cpus[cpu].shared_topology());
+    }
+  return retval;
+}
+
+
+EmbeddingResult embed_with_method(const SmartDigraph& g,
+				  const SmartGraph& cg,
+				  const std::vector<Cpu>& cpus,
+				  const std::vector<Flow>& flows,
+				  const std::vector<Module>& modules,
+				  const EmbedOptions& opts,
+				  EmbedStat* stat)
+{
+  // runs the presolve checks, the selected method (optionally per
+  // independent component) and the refinement stage
+  const std::string& method = opts.method;
+  const bool max_obj_func = opts.max_obj_func;
+  EmbedStat st;
+  EmbeddingResult res;
+
+  {
+    MetricsPhase phase("embed.presolve");
+    presolve_instance(g, cg, cpus, modules, opts.disabled_cpus, &st.presolve);
+  }
+
+  // disabled cpus: the ilp excludes them, the other methods see them with
+  // a negative capacity, which no module (not even one of weight 0) fits
+  std::vector<Cpu> usable_cpus;
+  if (opts.disabled_cpus.empty() == false)
+    usable_cpus = _disable_cpus(cpus, opts.disabled_cpus, -1);
+  const std::vector<Cpu>& usable = opts.disabled_cpus.empty() ? cpus : usable_cpus;
+
+  if (opts.decompose == true)
+    {
+      EmbedOptions sub_opts = opts;
+      sub_opts.decompose = false;
+      sub_opts.refine = false;
+      // the thread pool runs the components, each of them single threaded
+      sub_opts.threads = 1;
+      InstanceEmbedder embed = [&sub_opts](const Instance& sub) {
+	return embed_with_method(sub.dfg, sub.cg, sub.cpus, sub.flows, sub.modules,
+				 sub_opts);
+      };
+      // the parts get no share of the disabled cpus, and exclude them
+      res = embed_decomposed(g, cg, _disable_cpus(cpus, opts.disabled_cpus, 0), flows,
+			     modules, embed, max_obj_func, opts.threads, &st.decompose);
+    }
+  else if (opts.starts > 1 || method == "random" || method == "rnd")
+    {
+      RandomizedEmbedder embed;
+      if (method == "bestfitdec" || method == "bfd")
+	embed = [&](std::default_random_engine& generator) {
+	  return embed_bestfitdecreasing(g, cg, usable, flows, modules,
+					 max_obj_func, &generator);
+	};
+      else if (method == "random" || method == "rnd")
+	embed = [&](std::default_random_engine& generator) {
+	  return embed_random(g, cg, usable, flows, modules,
+			      max_obj_func, generator);
+	};
+      else
+	throw std::runtime_error("Multi-start is only supported by randomized methods");
+      res = embed_multistart(embed, std::max(opts.starts, 1), opts.seed, opts.threads,
+			     &st.multistart);
+    }
+  else if (method == "ilp")
+    {
+      IlpOptions ilp_opts;
+      ilp_opts.time_limit = opts.time_limit;
+      ilp_opts.mip_gap = opts.mip_gap;
+      ilp_opts.threads = opts.threads;
+      ilp_opts.disabled_cpus = opts.disabled_cpus;
+
+      const std::string& warm_start = opts.warm_start;
+      EmbeddingResult start;
+      if (warm_start != "greedy" && warm_start != "g" &&
+	  warm_start != "bestfitdec" && warm_start != "bfd" && warm_start != "none")
+	throw std::runtime_error("Invalid warm start method");
+      try {
+	MetricsPhase phase("embed.warm_start");
+	if (warm_start == "greedy" || warm_start == "g")
+	  start = embed_greedy(g, cg, usable, flows, modules, max_obj_func);
+	else if (warm_start == "bestfitdec" || warm_start == "bfd")
+	  start = embed_bestfitdecreasing(g, cg, usable, flows, modules, max_obj_func);
+	if (warm_start != "none")
+	  ilp_opts.mip_start = &start;
+      } catch (std::runtime_error& error) {
+	// no feasible incumbent, solve cold
+      }
+
+      res = embed_ilp(g, cg, cpus, flows, modules, max_obj_func, opts.show_solver_log,
+		      ilp_opts);
+    }
+  else if (method == "greedy" || method == "g")
+    {
+      res = embed_greedy(g, cg, usable, flows, modules, max_obj_func);
+    }
+  else if (method == "bestfitdec" || method == "bfd")
+    {
+      res = embed_bestfitdecreasing(g, cg, usable, flows, modules, max_obj_func);
+    }
+  else if (method == "roundrobin" || method == "rr")
+    {
+      res = embed_roundrobin(g, cg, usable, flows, modules, max_obj_func);
+    }
+  else
+    throw std::runtime_error("Invalid method");
+
+  if (opts.refine == true)
+    {
+      MetricsPhase phase("embed.refine");
+      RefineOptions refine_opts;
+      refine_opts.iterations = opts.refine_iters;
+      refine_opts.time_limit_ms = opts.refine_time;
+      refine_opts.seed = opts.seed;
+      res = refine_embedding(g, cg, usable, flows, modules, res,
+			     max_obj_func, refine_opts, &st.refine);
+      metrics().add("refine_iterations", st.refine.iterations);
+      metrics().add("refine_accepted", st.refine.accepted);
+    }
+
+  if (stat != nullptr)
+    *stat = st;
+  return res;
+}
+
+
+EmbeddingResult reembed_with_method(const SmartDigraph& g,
+				    const SmartGraph& cg,
+				    const std::vector<Cpu>& cpus,
+				    const std::vector<Flow>& flows,
+				    const std::vector<Module>& modules,
+				    const std::vector<size_t>& previous,
+				    const EmbedOptions& opts,
+				    const ReembedOptions& reembed_opts,
+				    EmbedStat* stat)
+{
+  // minimal-migration re-embedding after cpu failures: the repair
+  // heuristic, optionally followed by the ilp with migration budget, or
+  // the selected heuristic placing only the displaced modules
+  std::vector<char> alive = get_alive_cpus(cpus.size(), reembed_opts.failed);
+  EmbedStat st;
+  EmbeddingResult res;
+  bool repaired = false;
+  if (opts.method != "ilp" && opts.method != "repair")
+    {
+      // the surviving cpus keep their modules and the heuristic places
+      // the displaced ones on what is left; no module is migrated
+      if (previous.size() != size_t(countNodes(g)))
+	throw std::runtime_error("Re-embedding not possible: incomplete mapping");
+      std::vector<Cpu> kept = cpus;
+      std::vector<Module> displaced;
+      for (const auto& module : modules)
+	{
+	  size_t v = g.id(module.node());
+	  if (alive[previous[v]] == true)
+	    kept[previous[v]].add_module(module);
+	  else
+	    displaced.push_back(module);
+	}
+      EmbedOptions place_opts = opts;
+      place_opts.disabled_cpus = reembed_opts.failed;
+      place_opts.decompose = false;
+      place_opts.refine = false;
+      res = embed_with_method(g, cg, kept, flows, displaced, place_opts, &st);
+      for (size_t v = 0; v < previous.size(); ++v)
+	if (alive[previous[v]] == true)
+	  res.mapping[v] = previous[v];
+      res.sol_value = get_flow_crossings(g, res.mapping, flows, opts.max_obj_func,
+					 get_topology(cpus));
+      st.reembed.displaced = displaced.size();
+      st.reembed.previous_value = get_flow_crossings(g, previous, flows, opts.max_obj_func,
+						     get_topology(cpus));
+      if (stat != nullptr)
+	*stat = st;
+      return res;
+    }
+
+  {
+    MetricsPhase phase("embed.presolve");
+    presolve_instance(g, cg, cpus, modules, reembed_opts.failed, &st.presolve);
+  }
+  try {
+    MetricsPhase phase("embed.repair");
+    res = repair_embedding(g, cg, cpus, flows, modules, previous, opts.max_obj_func,
+			   reembed_opts, &st.reembed);
+    repaired = true;
+  } catch (std::runtime_error& error) {
+    if (opts.method != "ilp")
+      throw;
+  }
+
+  if (opts.method == "ilp")
+    {
+      IlpOptions ilp_opts;
+      ilp_opts.time_limit = opts.time_limit;
+      ilp_opts.mip_gap = opts.mip_gap;
+      ilp_opts.threads = opts.threads;
+      ilp_opts.disabled_cpus = reembed_opts.failed;
+      ilp_opts.previous = &previous;
+      ilp_opts.max_migrations = reembed_opts.budget;
+      EmbeddingResult start = res;
+      if (repaired == true)
+	ilp_opts.mip_start = &start;
+      res = embed_ilp(g, cg, cpus, flows, modules, opts.max_obj_func, opts.show_solver_log,
+		      ilp_opts);
+
+      st.reembed.displaced = 0;
+      st.reembed.migrated = 0;
+      for (size_t v = 0; v < previous.size(); ++v)
+	{
+	  if (alive[previous[v]] == false)
+	    ++st.reembed.displaced;
+	  else if (res.mapping[v] != previous[v])
+	    ++st.reembed.migrated;
+	}
+      st.reembed.previous_value = get_flow_crossings(g, previous, flows, opts.max_obj_func,
+						       get_topology(cpus));
+    }
+
+  if (stat != nullptr)
+    *stat = st;
+  return res;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMBED_H
+#define EMBED_H
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "embed-bestfitdec.h"
+#include "embed-common.h"
+#include "embed-decompose.h"
+#include "embed-greedy.h"
+#include "embed-ilp.h"
+#include "embed-multistart.h"
+#include "embed-presolve.h"
+#include "embed-random.h"
+#include "embed-reembed.h"
+#include "embed-refine.h"
+#include "embed-roundrobin.h"
+#include "flow.h"
+#include "metrics.h"
+#include "module.h"
+
+using namespace lemon;
+
+
+struct EmbedOptions
+{
+  // embedding method and its parameters, as set on the command line
+  std::string method = "ilp";
+  bool max_obj_func = false;
+  bool show_solver_log = false;
+
+  // randomized methods
+  int starts = 1;
+  int threads = 0;
+  unsigned seed = 0;
+
+  // ilp
+  double time_limit = 0;
+  double mip_gap = 0;
+  std::string warm_start = "greedy";
+
+  // post-processing and decomposition
+  bool refine = false;
+  int refine_iters = 1000000;
+  int refine_time = 100;
+  bool decompose = false;
+
+  // cpus taking no module, e.g. failed ones of an earlier re-embedding
+  std::vector<size_t> disabled_cpus;
+};
+
+
+struct EmbedStat
+{
+  PresolveStat presolve;
+  MultiStartStat multistart;
+  RefineStat refine;
+  DecomposeStat decompose;
+  ReembedStat reembed;
+};
+
+
+// the dispatch of the embedding methods is defined in embed.cc, compiled
+// once into libdfgembed
+EmbeddingResult embed_with_method(const SmartDigraph& g,
+				  const SmartGraph& cg,
+				  const std::vector<Cpu>& cpus,
+				  const std::vector<Flow>& flows,
+				  const std::vector<Module>& modules,
+				  const EmbedOptions& opts,
+				  EmbedStat* stat = nullptr);
+
+
+EmbeddingResult reembed_with_method(const SmartDigraph& g,
+				    const SmartGraph& cg,
+				    const std::vector<Cpu>& cpus,
+				    const std::vector<Flow>& flows,
+				    const std::vector<Module>& modules,
+				    const std::vector<size_t>& previous,
+				    const EmbedOptions& opts,
+				    const ReembedOptions& reembed_opts,
+				    EmbedStat* stat = nullptr);
+
+
+#endif  // EMBED_H
@@ -28,25 +28,33 @@ class Flow
 {
  public:
   Flow() {}
-  Flow(std::string name, const std::vector<Module>& modules)
+  Flow(std::string name, const std::vector<Module>& modules, long rate = 1)
     {
       name_ = name;
       modules_ = modules;
+      rate_ = rate;
     }
 
   friend std::ostream& operator<<(std::ostream& out, const Flow& f);
 
   const std::string& name() const { return name_; }
   const std::vector<Module>& modules() const { return modules_; }
+  // traffic rate (e.g. packets/s), the weight of the flow's crossings
+  long rate() const { return rate_; }
 
  private:
   std::string name_;
   std::vector<Module> modules_;
+  long rate_ = 1;
 };
 
-std::ostream& operator<<(std::ostream& out, const Flow& f)
+inline std::ostream& operator<<(std::ostream& out, const Flow& f)
 {
-  return out << f.name() << ":  " << print_modules(f.modules());
+  out << f.name() << ":  ";
+  print_modules(out, f.modules());
+  if (f.rate() != 1)
+    out << "  (rate: " << f.rate() << ")";
+  return out;
 }
 
 #endif  // FLOW_H
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "flow.h"
+#include "instance.h"
+#include "module.h"
+#include "utils.h"
+
+using namespace lemon;
+
+
+struct MgwParams
+{
+  // same meaning as the arguments of utils/gen_mgw_lgf.py
+  int users = 2;
+  int bearers = 2;
+  int bearer0_users = 1;
+  int cpu_number = 5;
+  float cpu_capacity = 25;  // 0: derived from slack
+  int conflicts = 0;  // number of CPU failures to cover
+  float slack = 1.5;  // total capacity / total module weight
+};
+
+
+struct LayeredParams
+{
+  // random layered dfg: every flow visits one random module per layer
+  int modules = 1000;
+  int layers = 10;
+  int flows = 100;
+  int weight_min = 1;
+  int weight_max = 10;
+  long conflicts = 0;  // random conflict pairs
+  int cpu_number = 16;
+  float cpu_capacity = 0;  // 0: derived from slack
+  float slack = 1.5;
+};
+
+
+class _InstanceBuilder
+{
+  // assembles an Instance the same way the LGF reader of dfg-embed does:
+  // node ids in creation order, modules in NodeIt order, flows sorted by
+  // name, one conflict graph node per module
+ public:
+  _InstanceBuilder(Instance& inst) : inst_(inst) {}
+
+  int add_module(const std::string& name, float weight)
+  {
+    int id = inst_.dfg.id(inst_.dfg.addNode());
+    inst_.cg.addNode();
+    names_.push_back(name);
+    weights_.push_back(weight);
+    return id;
+  }
+
+  void add_flow(const std::string& name, const std::vector<int>& path)
+  {
+    flows_.push_back(std::make_pair(name, path));
+    for (size_t i = 0; i + 1 < path.size(); ++i)
+      if (arcs_.insert(_key(path[i], path[i+1])).second == true)
+	inst_.dfg.addArc(inst_.dfg.nodeFromId(path[i]),
+			 inst_.dfg.nodeFromId(path[i+1]));
+  }
+
+  void add_conflict(int u, int v)
+  {
+    if (u != v)
+      conflicts_.push_back(_key(std::min(u, v), std::max(u, v)));
+  }
+
+  const std::vector<float>& weights() const { return weights_; }
+
+  void finish(int cpu_number, float cpu_capacity, float slack)
+  {
+    std::sort(conflicts_.begin(), conflicts_.end());
+    conflicts_.erase(std::unique(conflicts_.begin(), conflicts_.end()),
+		     conflicts_.end());
+    for (uint64_t c : conflicts_)
+      inst_.cg.addEdge(inst_.cg.nodeFromId(c >> 32),
+		       inst_.cg.nodeFromId(c & 0xffffffff));
+
+    std::vector<Module> module_by_id(names_.size());
+    for (SmartDigraph::NodeIt n(inst_.dfg); n != INVALID; ++n)
+      {
+	int id = inst_.dfg.id(n);
+	module_by_id[id] = Module(n, names_[id], weights_[id]);
+	inst_.modules.push_back(module_by_id[id]);
+      }
+
+    std::stable_sort(flows_.begin(), flows_.end(),
+		     [](const std::pair<std::string, std::vector<int>>& a,
+			const std::pair<std::string, std::vector<int>>& b) {
+		       return a.first < b.first;
+		     });
+    for (const auto& f : flows_)
+      {
+	std::vector<Module> path;
+	for (int id : f.second)
+	  path.push_back(module_by_id[id]);
+	inst_.flows.push_back(Flow(f.first, path));
+      }
+
+    if (cpu_capacity <= 0)
+      {
+	float total = std::accumulate(weights_.begin(), weights_.end(), 0.0f);
+	float max_w = weights_.empty() ? 0 :
+	  *std::max_element(weights_.begin(), weights_.end());
+	cpu_capacity = std::max(max_w, std::ceil(total * slack / cpu_number));
+      }
+    for (int i = 0; i < cpu_number; ++i)
+      inst_.cpus.push_back(Cpu(i, cpu_capacity));
+  }
+
+ private:
+  static uint64_t _key(int u, int v) { return (uint64_t(u) << 32) | uint32_t(v); }
+
+  Instance& inst_;
+  std::vector<std::string> names_;
+  std::vector<float> weights_;
+  std::vector<std::pair<std::string, std::vector<int>>> flows_;
+  std::unordered_set<uint64_t> arcs_;
+  std::vector<uint64_t> conflicts_;
+};
+
+
+inline void generate_mgw(Instance& inst, const MgwParams& p)
+{
+  // mobile gateway pipeline, a port of utils/gen_mgw_lgf.py that builds
+  // the instance in memory
+  static const std::map<std::string, float> module_weights = {
+    {"mac_table", 1}, {"type_check", 1}, {"dir_selector", 1},
+    {"dl_br_selector", 20}, {"dl_ue_selector", 20},
+    {"vxlan_decap", 10}, {"ul_br_selector", 10}, {"ul_ue_selector", 10},
+    {"update_ttl", 1}, {"L3", 1}, {"update_mac_dl", 1}, {"ip_checksum_dl", 1},
+    {"update_mac_ul", 1}, {"ip_checksum_ul", 1},
+    {"dl_user_bp", 20}, {"setmd_dl", 20}, {"vxlan_encap", 20},
+    {"ip_encap", 20}, {"ether_encap", 20},
+    {"ul_user_bp", 10}, {"setmd_ul", 10},
+  };
+  if (p.cpu_number <= 0)
+    throw std::runtime_error("Generator: cpu number must be positive");
+
+  _InstanceBuilder b(inst);
+  std::unordered_map<std::string, int> module_ids;
+
+  // (name, weight name) pairs, followed by a copy per conflict id
+  auto add_modules = [&](const std::vector<std::pair<std::string, std::string>>& names,
+			 bool with_conflicts) {
+    std::vector<std::pair<std::string, std::string>> all = names;
+    if (with_conflicts == true)
+      for (const auto& name : names)
+	for (int c = 0; c < p.conflicts; ++c)
+	  all.push_back(std::make_pair(name.first + "-c" + std::to_string(c), name.second));
+    for (const auto& name : all)
+      module_ids[name.first] = b.add_module(name.first, module_weights.at(name.second));
+  };
+
+  std::vector<std::pair<std::string, std::string>> common;
+  for (const char* name : {"mac_table", "type_check", "dir_selector",
+			   "dl_br_selector", "vxlan_decap", "ul_br_selector",
+			   "update_ttl", "L3", "update_mac_dl",
+			   "ip_checksum_dl", "update_mac_ul", "ip_checksum_ul"})
+    common.push_back(std::make_pair(name, name));
+  add_modules(common, true);
+
+  const std::vector<std::string> user_names = {
+    "ul_user_bp", "setmd_ul",
+    "dl_user_bp", "setmd_dl", "vxlan_encap", "ip_encap", "ether_encap"};
+  for (int bearer = 0; bearer < p.bearers; ++bearer)
+    {
+      const std::string bs = std::to_string(bearer);
+      add_modules({{"dl_ue_selector_" + bs, "dl_ue_selector"},
+		   {"ul_ue_selector_" + bs, "ul_ue_selector"}}, bearer == 0);
+      for (int user = 0; user < p.users; ++user)
+	{
+	  if (bearer == 0 && user >= p.bearer0_users)
+	    continue;
+	  std::vector<std::pair<std::string, std::string>> names;
+	  for (const auto& name : user_names)
+	    names.push_back(std::make_pair(name + "_" + std::to_string(user) + "_" + bs,
+					   name));
+	  add_modules(names, bearer == 0);
+	}
+    }
+
+  auto flow_modules = [&](char dir, int bearer, int user, int conflict) {
+    const std::string bs = std::to_string(bearer);
+    const std::string ub = std::to_string(user) + "_" + bs;
+    std::vector<std::string> names;
+    if (dir == 'd')
+      names = {"mac_table", "type_check", "dir_selector", "dl_br_selector",
+	       "dl_ue_selector_" + bs, "dl_user_bp_" + ub,
+	       "setmd_dl_" + ub, "vxlan_encap_" + ub,
+	       "ip_encap_" + ub, "ether_encap_" + ub,
+	       "update_ttl", "L3", "update_mac_dl", "ip_checksum_dl"};
+    else
+      names = {"mac_table", "type_check", "dir_selector",
+	       "vxlan_decap", "ul_br_selector",
+	       "ul_ue_selector_" + bs, "ul_user_bp_" + ub,
+	       "setmd_ul_" + ub,
+	       "update_ttl", "L3", "update_mac_ul", "ip_checksum_ul"};
+    std::vector<int> path;
+    for (const auto& name : names)
+      path.push_back(module_ids.at(conflict < 0 ? name :
+				   name + "-c" + std::to_string(conflict)));
+    return path;
+  };
+
+  // bearer0 flows (main and backup copies) by direction
+  std::vector<std::vector<int>> bearer0_flows[2];
+  for (int bearer = 0; bearer < p.bearers; ++bearer)
+    for (int user = 0; user < p.users; ++user)
+      {
+	if (bearer == 0 && user >= p.bearer0_users)
+	  continue;
+	for (char dir : {'u', 'd'})
+	  {
+	    std::string name = std::string(1, dir) + "l_" + std::to_string(user) +
+	      "_" + std::to_string(bearer);
+	    b.add_flow(name, flow_modules(dir, bearer, user, -1));
+	    if (bearer != 0)
+	      continue;
+	    bearer0_flows[dir == 'd'].push_back(flow_modules(dir, bearer, user, -1));
+	    for (int c = 0; c < p.conflicts; ++c)
+	      {
+		b.add_flow(name + "-c" + std::to_string(c), flow_modules(dir, bearer, user, c));
+		bearer0_flows[dir == 'd'].push_back(flow_modules(dir, bearer, user, c));
+	      }
+	  }
+      }
+
+  // every module of a bearer0 flow conflicts with the modules of the
+  // other bearer0 flows of the same direction
+  for (const auto& dir_flows : bearer0_flows)
+    for (size_t i = 0; i < dir_flows.size(); ++i)
+      for (size_t j = i + 1; j < dir_flows.size(); ++j)
+	for (int u : dir_flows[i])
+	  for (int v : dir_flows[j])
+	    b.add_conflict(u, v);
+
+  b.finish(p.cpu_number, p.cpu_capacity, p.slack);
+}
+
+
+inline void generate_layered(Instance& inst, const LayeredParams& p, unsigned seed)
+{
+  // random layered dfg with p.modules modules split evenly into p.layers
+  // layers; each flow visits one uniformly chosen module of every layer
+  if (p.layers <= 0 || p.modules < p.layers || p.cpu_number <= 0 ||
+      p.weight_min > p.weight_max)
+    throw std::runtime_error("Generator: invalid layered instance parameters");
+
+  std::default_random_engine generator(seed);
+  std::uniform_int_distribution<int> rnd_weight(p.weight_min, p.weight_max);
+  _InstanceBuilder b(inst);
+
+  for (int i = 0; i < p.modules; ++i)
+    b.add_module("m" + std::to_string(i), rnd_weight(generator));
+
+  for (int f = 0; f < p.flows; ++f)
+    {
+      std::vector<int> path;
+      for (int l = 0; l < p.layers; ++l)
+	{
+	  std::uniform_int_distribution<int> rnd_module(
+	    (long)l * p.modules / p.layers, (long)(l + 1) * p.modules / p.layers - 1);
+	  path.push_back(rnd_module(generator));
+	}
+      b.add_flow("f" + std::to_string(f), path);
+    }
+
+  std::uniform_int_distribution<int> rnd_any(0, p.modules - 1);
+  for (long c = 0; p.modules > 1 && c < p.conflicts; ++c)
+    b.add_conflict(rnd_any(generator), rnd_any(generator));
+
+  b.finish(p.cpu_number, p.cpu_capacity, p.slack);
+}
+
+
+inline void generate_instance(Instance& inst, const std::string& spec, unsigned seed)
+{
+  // spec: "mgw" or "layered", optionally followed by ':' and comma
+  // separated key=value parameters, e.g. "layered:n=100000,L=20,f=5000"
+  std::string kind = spec.substr(0, spec.find(':'));
+  std::map<std::string, std::string> params;
+  if (spec.find(':') != std::string::npos)
+    for (const auto& kv : split_string_to_vec(spec.substr(spec.find(':') + 1)))
+      {
+	size_t eq = kv.find('=');
+	if (eq == std::string::npos)
+	  throw std::runtime_error("Generator: invalid parameter '" + kv + "'");
+	params[kv.substr(0, eq)] = kv.substr(eq + 1);
+      }
+
+  auto set = [&params](const std::string& key, auto& value) {
+    auto it = params.find(key);
+    if (it == params.end())
+      return;
+    std::istringstream ss(it->second);
+    if (!(ss >> value))
+      throw std::runtime_error("Generator: invalid value of '" + key + "'");
+    params.erase(it);
+  };
+
+  if (kind == "mgw")
+    {
+      MgwParams p;
+      set("u", p.users);
+      set("b", p.bearers);
+      set("B", p.bearer0_users);
+      set("c", p.cpu_number);
+      set("C", p.cpu_capacity);
+      set("l", p.conflicts);
+      set("s", p.slack);
+      if (params.empty() == false)
+	throw std::runtime_error("Generator: unknown parameter '" + params.begin()->first + "'");
+      generate_mgw(inst, p);
+    }
+  else if (kind == "layered")
+    {
+      LayeredParams p;
+      set("n", p.modules);
+      set("L", p.layers);
+      set("f", p.flows);
+      set("w", p.weight_min);
+      set("W", p.weight_max);
+      set("k", p.conflicts);
+      set("c", p.cpu_number);
+      set("C", p.cpu_capacity);
+      set("s", p.slack);
+      if (params.empty() == false)
+	throw std::runtime_error("Generator: unknown parameter '" + params.begin()->first + "'");
+      generate_layered(inst, p, seed);
+    }
+  else
+    throw std::runtime_error("Generator: unknown instance type '" + kind + "'");
+}
+
+
+#endif  // GENERATE_H
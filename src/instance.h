@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "flow.h"
+#include "module.h"
+#include "topology.h"
+
+using namespace lemon;
+
+
+struct Instance
+{
+  // an embedding problem: dataflow graph, conflict graph (with one node
+  // per module, sharing node ids with dfg), modules, flows and cpus
+  SmartDigraph dfg;
+  SmartGraph cg;
+  std::vector<Module> modules;
+  std::vector<Flow> flows;
+  std::vector<Cpu> cpus;
+
+  Instance() {}
+  // lemon graphs are not copyable
+  Instance(const Instance&) = delete;
+  Instance& operator=(const Instance&) = delete;
+};
+
+
+inline void update_module_weights(Instance& inst, const std::vector<float>& weights)
+{
+  // sets the weight of every module (indexed by node id), in the module
+  // list and in the flow paths alike
+  auto updated = [&inst, &weights](const Module& m) {
+    SmartDigraph::Node n = m.node();
+    return Module(n, m.name(), weights.at(inst.dfg.id(n)));
+  };
+  for (auto& module : inst.modules)
+    module = updated(module);
+  for (auto& flow : inst.flows)
+    {
+      std::vector<Module> path;
+      for (const auto& module : flow.modules())
+	path.push_back(updated(module));
+      flow = Flow(flow.name(), path, flow.rate());
+    }
+}
+
+
+inline void load_topology(Instance& inst, const std::string& lscpu_file)
+{
+  // replaces the cpu topology with the one of an lscpu -p dump, keeping
+  // the crossing costs of the instance (if any)
+  Topology::Costs costs = Topology::default_costs();
+  if (inst.cpus.empty() == false && inst.cpus[0].topology() != nullptr)
+    costs = inst.cpus[0].topology()->costs();
+  std::shared_ptr<const Topology> topology =
+    read_lscpu_topology(lscpu_file, inst.cpus.size(), costs);
+  for (auto& cpu : inst.cpus)
+    cpu.set_topology(topology);
+}
+
+
+#endif  // INSTANCE_H
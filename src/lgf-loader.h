@@ -0,0 +1,635 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LGF_LOADER_H
+#define LGF_LOADER_H
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "flow.h"
+#include "instance.h"
+#include "metrics.h"
+#include "module.h"
+
+using namespace lemon;
+
+
+class _MappedFile
+{
+  // read-only memory mapping of a whole file
+ public:
+  _MappedFile(const std::string& path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error(path + ": " + std::strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+      {
+	close(fd);
+	throw std::runtime_error(path + ": " + std::strerror(errno));
+      }
+    size_ = st.st_size;
+    if (size_ > 0)
+      {
+	void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	  {
+	    close(fd);
+	    throw std::runtime_error(path + ": " + std::strerror(errno));
+	  }
+	madvise(data, size_, MADV_SEQUENTIAL);
+	data_ = static_cast<const char*>(data);
+      }
+    close(fd);
+  }
+  ~_MappedFile()
+  {
+    if (data_ != nullptr)
+      munmap(const_cast<char*>(data_), size_);
+  }
+  _MappedFile(const _MappedFile&) = delete;
+  _MappedFile& operator=(const _MappedFile&) = delete;
+
+  const char* begin() const { return data_; }
+  const char* end() const { return data_ + size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+
+[[noreturn]] inline void _lgf_error(const std::string& file, size_t line, const std::string& msg)
+{
+  throw std::runtime_error(file + ":" + std::to_string(line) + ": " + msg);
+}
+
+
+class _LgfTokenizer
+{
+  // zero-copy LGF tokenizer: tokens point into the mapped file, only
+  // quoted tokens with escape sequences are copied
+ public:
+  _LgfTokenizer(const char* begin, const char* end, const std::string& file)
+    : pos_(begin), line_end_(begin), next_(begin), end_(end), file_(file) {}
+
+  bool next_line()
+  {
+    // steps to the next non-empty, non-comment line
+    while (next_ < end_)
+      {
+	pos_ = next_;
+	++line_;
+	const char* nl = static_cast<const char*>(std::memchr(pos_, '\n', end_ - pos_));
+	line_end_ = (nl != nullptr) ? nl : end_;
+	next_ = (nl != nullptr) ? nl + 1 : end_;
+	_skip_space();
+	if (pos_ != line_end_ && *pos_ != '#')
+	  return true;
+      }
+    return false;
+  }
+
+  bool is_section() const { return pos_ != line_end_ && *pos_ == '@'; }
+
+  bool next_token(std::string_view& token)
+  {
+    _skip_space();
+    if (pos_ == line_end_)
+      return false;
+    if (*pos_ != '"')
+      {
+	const char* begin = pos_;
+	while (pos_ != line_end_ && !_is_space(*pos_))
+	  ++pos_;
+	token = std::string_view(begin, pos_ - begin);
+	return true;
+      }
+
+    const char* begin = ++pos_;
+    bool escaped = false;
+    while (pos_ != line_end_ && *pos_ != '"')
+      {
+	if (*pos_ == '\\' && pos_ + 1 != line_end_)
+	  {
+	    escaped = true;
+	    ++pos_;
+	  }
+	++pos_;
+      }
+    if (pos_ == line_end_)
+      error("unterminated quoted string");
+    token = std::string_view(begin, pos_ - begin);
+    ++pos_;
+    if (escaped == true)
+      {
+	std::string s;
+	for (size_t i = 0; i < token.size(); ++i)
+	  {
+	    char c = token[i];
+	    if (c == '\\')
+	      {
+		c = token[++i];
+		if (c == 'n')
+		  c = '\n';
+		else if (c == 't')
+		  c = '\t';
+	      }
+	    s.push_back(c);
+	  }
+	copies_.push_back(s);
+	token = copies_.back();
+      }
+    return true;
+  }
+
+  size_t line() const { return line_; }
+
+  [[noreturn]] void error(const std::string& msg) const { _lgf_error(file_, line_, msg); }
+
+ private:
+  static bool _is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+  void _skip_space()
+  {
+    while (pos_ != line_end_ && _is_space(*pos_))
+      ++pos_;
+  }
+
+  const char* pos_;
+  const char* line_end_;
+  const char* next_;
+  const char* end_;
+  size_t line_ = 0;
+  const std::string& file_;
+  std::deque<std::string> copies_;  // unescaped tokens, stable addresses
+};
+
+
+template<typename T>
+T _lgf_number(std::string_view token, const char* what,
+	      const std::string& file, size_t line)
+{
+  // tokens are not null terminated
+  char buf[64];
+  if (token.empty() || token.size() >= sizeof(buf))
+    _lgf_error(file, line, std::string("invalid ") + what + " '" + std::string(token) + "'");
+  std::memcpy(buf, token.data(), token.size());
+  buf[token.size()] = '\0';
+  char* end;
+  errno = 0;
+  T value;
+  if constexpr (std::is_floating_point<T>::value)
+    value = std::strtof(buf, &end);
+  else
+    value = std::strtol(buf, &end, 10);
+  if (end != buf + token.size() || errno != 0)
+    _lgf_error(file, line, std::string("invalid ") + what + " '" + std::string(token) + "'");
+  return value;
+}
+
+
+inline void load_instance_lgf(Instance& inst, const std::string& in_file)
+{
+  // single pass pipeline description LGF loader over a memory mapped
+  // file: @nodes (label, name, weight), @arcs, @attributes (cpu_number,
+  // cpu_capacity), @flows, the optional @conflicts (label pairs) and
+  // @conflictgroups (one group of mutually conflicting labels per line,
+  // expanded to pairs), the optional @cpus
+  // (label: cpu id, capacity) overriding cpu_capacity per cpu and the
+  // optional @topology (label: cpu id, core, numa, socket) with the
+  // crossing costs in the cost_smt, cost_core, cost_numa and cost_socket
+  // attributes, and the optional @rates (flow name and rate pairs); throws
+  // runtime_error with the file and line number on malformed input
+  auto t_parse = std::chrono::steady_clock::now();
+  _MappedFile file(in_file);
+  _LgfTokenizer tok(file.begin(), file.end(), in_file);
+
+  SmartDigraph& dfg = inst.dfg;
+  std::unordered_map<std::string_view, int> node_by_label;
+  std::unordered_map<std::string_view, int> node_by_name;
+  std::vector<std::string_view> names;
+  std::vector<float> weights;
+  std::map<std::string_view, std::pair<std::string_view, size_t>> flow_lines;
+  std::vector<std::pair<int, int>> conflicts;
+  std::map<std::string_view, std::pair<std::string_view, size_t>> attributes;
+  std::map<std::string_view, std::pair<long, size_t>> flow_rates;
+  std::map<long, float> cpu_capacities;
+  size_t cpu_line = 0;  // line of the largest cpu id
+  std::map<long, std::array<size_t, 3>> cpu_groups;  // core, numa, socket
+  bool has_topology = false;
+  bool has_nodes = false;
+  bool has_flows = false;
+  bool has_conflicts = false;
+
+  enum { NONE, NODES, ARCS, ATTRIBUTES, FLOWS, CONFLICTS, CONFLICTGROUPS, CPUS, TOPOLOGY, RATES, OTHER } section = NONE;
+  bool header = false;  // next line is the column header of the section
+  int label_col = -1;
+  int name_col = -1;
+  int weight_col = -1;
+  int cpu_label_col = -1;
+  int capacity_col = -1;
+  int group_cols[3] = {-1, -1, -1};  // core, numa, socket
+  size_t columns = 0;
+
+  auto node_of = [&](std::string_view label) {
+    auto it = node_by_label.find(label);
+    if (it == node_by_label.end())
+      tok.error("unknown node label '" + std::string(label) + "'");
+    return it->second;
+  };
+
+  std::string_view token;
+  std::vector<std::string_view> row;
+  while (tok.next_line())
+    {
+      if (tok.is_section())
+	{
+	  tok.next_token(token);
+	  token.remove_prefix(1);
+	  header = false;
+	  if (token == "nodes")
+	    {
+	      section = NODES;
+	      header = true;
+	      has_nodes = true;
+	    }
+	  else if (token == "arcs")
+	    {
+	      section = ARCS;
+	      header = true;
+	    }
+	  else if (token == "attributes")
+	    section = ATTRIBUTES;
+	  else if (token == "flows")
+	    {
+	      section = FLOWS;
+	      has_flows = true;
+	    }
+	  else if (token == "conflicts")
+	    {
+	      section = CONFLICTS;
+	      has_conflicts = true;
+	    }
+	  else if (token == "conflictgroups")
+	    {
+	      section = CONFLICTGROUPS;
+	      has_conflicts = true;
+	    }
+	  else if (token == "cpus")
+	    {
+	      section = CPUS;
+	      header = true;
+	    }
+	  else if (token == "rates")
+	    section = RATES;
+	  else if (token == "topology")
+	    {
+	      section = TOPOLOGY;
+	      header = true;
+	      has_topology = true;
+	    }
+	  else
+	    section = OTHER;
+	  continue;
+	}
+
+      row.clear();
+      while (tok.next_token(token))
+	row.push_back(token);
+
+      switch (section)
+	{
+	case NODES:
+	  if (header == true)
+	    {
+	      for (size_t i = 0; i < row.size(); ++i)
+		{
+		  if (row[i] == "label")
+		    label_col = i;
+		  else if (row[i] == "name")
+		    name_col = i;
+		  else if (row[i] == "weight")
+		    weight_col = i;
+		}
+	      if (label_col < 0 || name_col < 0 || weight_col < 0)
+		tok.error("@nodes needs label, name and weight columns");
+	      columns = row.size();
+	      header = false;
+	      break;
+	    }
+	  if (row.size() != columns)
+	    tok.error("expected " + std::to_string(columns) + " values, found " +
+		      std::to_string(row.size()));
+	  {
+	    int id = dfg.id(dfg.addNode());
+	    if (node_by_label.emplace(row[label_col], id).second == false)
+	      tok.error("duplicate node label '" + std::string(row[label_col]) + "'");
+	    node_by_name[row[name_col]] = id;
+	    names.push_back(row[name_col]);
+	    weights.push_back(_lgf_number<float>(row[weight_col], "weight",
+						 in_file, tok.line()));
+	  }
+	  break;
+
+	case ARCS:
+	  if (header == true)
+	    {
+	      columns = row.size() + 2;
+	      header = false;
+	      break;
+	    }
+	  if (row.size() != columns)
+	    tok.error("expected " + std::to_string(columns) + " values, found " +
+		      std::to_string(row.size()));
+	  dfg.addArc(dfg.nodeFromId(node_of(row[0])), dfg.nodeFromId(node_of(row[1])));
+	  break;
+
+	case ATTRIBUTES:
+	  if (row.size() != 2)
+	    tok.error("expected an attribute name and value");
+	  attributes[row[0]] = std::make_pair(row[1], tok.line());
+	  break;
+
+	case FLOWS:
+	  // name and module list pairs, the last definition of a name wins
+	  if (row.size() % 2 != 0)
+	    tok.error("expected a flow name and a module list");
+	  for (size_t i = 0; i < row.size(); i += 2)
+	    flow_lines[row[i]] = std::make_pair(row[i+1], tok.line());
+	  break;
+
+	case CONFLICTS:
+	  if (row.size() % 2 != 0)
+	    tok.error("expected pairs of conflicting node labels");
+	  for (size_t i = 0; i < row.size(); i += 2)
+	    conflicts.push_back(std::make_pair(node_of(row[i]), node_of(row[i+1])));
+	  break;
+
+	case CONFLICTGROUPS:
+	  if (row.size() < 2)
+	    tok.error("expected a group of at least two conflicting node labels");
+	  for (size_t i = 0; i < row.size(); ++i)
+	    for (size_t j = i + 1; j < row.size(); ++j)
+	      conflicts.push_back(std::make_pair(node_of(row[i]), node_of(row[j])));
+	  break;
+
+	case CPUS:
+	  if (header == true)
+	    {
+	      for (size_t i = 0; i < row.size(); ++i)
+		{
+		  if (row[i] == "label")
+		    cpu_label_col = i;
+		  else if (row[i] == "capacity")
+		    capacity_col = i;
+		}
+	      if (cpu_label_col < 0 || capacity_col < 0)
+		tok.error("@cpus needs label and capacity columns");
+	      columns = row.size();
+	      header = false;
+	      break;
+	    }
+	  if (row.size() != columns)
+	    tok.error("expected " + std::to_string(columns) + " values, found " +
+		      std::to_string(row.size()));
+	  {
+	    long id = _lgf_number<long>(row[cpu_label_col], "cpu id", in_file, tok.line());
+	    if (id < 0)
+	      tok.error("invalid cpu id '" + std::string(row[cpu_label_col]) + "'");
+	    float cap = _lgf_number<float>(row[capacity_col], "capacity",
+					   in_file, tok.line());
+	    if (cpu_capacities.emplace(id, cap).second == false)
+	      tok.error("duplicate cpu id '" + std::string(row[cpu_label_col]) + "'");
+	    if (id == cpu_capacities.rbegin()->first)
+	      cpu_line = tok.line();
+	  }
+	  break;
+
+	case TOPOLOGY:
+	  // numa and socket default to 0
+	  if (header == true)
+	    {
+	      cpu_label_col = -1;
+	      for (size_t i = 0; i < row.size(); ++i)
+		{
+		  if (row[i] == "label")
+		    cpu_label_col = i;
+		  else if (row[i] == "core")
+		    group_cols[0] = i;
+		  else if (row[i] == "numa")
+		    group_cols[1] = i;
+		  else if (row[i] == "socket")
+		    group_cols[2] = i;
+		}
+	      if (cpu_label_col < 0 || group_cols[0] < 0)
+		tok.error("@topology needs label and core columns");
+	      columns = row.size();
+	      header = false;
+	      break;
+	    }
+	  if (row.size() != columns)
+	    tok.error("expected " + std::to_string(columns) + " values, found " +
+		      std::to_string(row.size()));
+	  {
+	    long id = _lgf_number<long>(row[cpu_label_col], "cpu id", in_file, tok.line());
+	    std::array<size_t, 3> groups = {{0, 0, 0}};
+	    for (size_t l = 0; l < 3; ++l)
+	      if (group_cols[l] >= 0)
+		{
+		  long group = _lgf_number<long>(row[group_cols[l]], "group id",
+						 in_file, tok.line());
+		  if (group < 0)
+		    tok.error("invalid " + Topology::group_name(l) + " id '" +
+			      std::string(row[group_cols[l]]) + "'");
+		  groups[l] = group;
+		}
+	    if (id < 0 || cpu_groups.emplace(id, groups).second == false)
+	      tok.error("invalid or duplicate cpu id '" + std::string(row[cpu_label_col]) + "'");
+	  }
+	  break;
+
+	case RATES:
+	  // flows without a rate have rate 1
+	  if (row.size() % 2 != 0)
+	    tok.error("expected a flow name and a rate");
+	  for (size_t i = 0; i < row.size(); i += 2)
+	    {
+	      long rate = _lgf_number<long>(row[i+1], "rate", in_file, tok.line());
+	      if (rate < 0)
+		tok.error("invalid rate '" + std::string(row[i+1]) + "'");
+	      flow_rates[row[i]] = std::make_pair(rate, tok.line());
+	    }
+	  break;
+
+	case NONE:
+	  tok.error("data outside of sections");
+	case OTHER:
+	  break;
+	}
+    }
+
+  if (has_nodes == false)
+    throw std::runtime_error(in_file + ": @nodes section not found");
+  if (has_flows == false)
+    throw std::runtime_error(in_file + ": @flows section not found");
+  if (attributes.count("cpu_number") == 0 && cpu_capacities.empty())
+    throw std::runtime_error(in_file + ": attribute 'cpu_number' not found");
+  metrics().add_phase("load.parse", elapsed_us(t_parse));
+
+  // init modules, conflict graph, flows and cpus
+  MetricsPhase phase("load.build");
+
+  // init modules, in the order of the LEMON reader
+  std::vector<Module> module_by_id(names.size());
+  for (SmartDigraph::NodeIt n(dfg); n != INVALID; ++n)
+    {
+      int id = dfg.id(n);
+      module_by_id[id] = Module(n, std::string(names[id]), weights[id]);
+      inst.modules.push_back(module_by_id[id]);
+    }
+
+  if (has_conflicts == true)
+    {
+      for (size_t i = 0; i < names.size(); ++i)
+	inst.cg.addNode();
+      for (const auto& c : conflicts)
+	inst.cg.addEdge(inst.cg.nodeFromId(c.first), inst.cg.nodeFromId(c.second));
+    }
+
+  // init flows, sorted by name
+  for (const auto& it : flow_lines)
+    {
+      std::vector<Module> path;
+      std::string_view list = it.second.first;
+      while (true)
+	{
+	  size_t comma = list.find(',');
+	  std::string_view name = list.substr(0, comma);
+	  auto m = node_by_name.find(name);
+	  if (m == node_by_name.end())
+	    _lgf_error(in_file, it.second.second,
+		       "unknown module '" + std::string(name) + "'");
+	  path.push_back(module_by_id[m->second]);
+	  if (comma == std::string_view::npos)
+	    break;
+	  list.remove_prefix(comma + 1);
+	}
+      auto rate = flow_rates.find(it.first);
+      inst.flows.push_back(Flow(std::string(it.first), path,
+				rate != flow_rates.end() ? rate->second.first : 1));
+    }
+  for (const auto& it : flow_rates)
+    if (flow_lines.count(it.first) == 0)
+      _lgf_error(in_file, it.second.second,
+		 "rate of unknown flow '" + std::string(it.first) + "'");
+
+  // init CPUs: cpu_number defaults to the largest @cpus id + 1, and
+  // cpu_capacity is only needed for cpus missing from @cpus
+  long cpu_number = 0;
+  if (attributes.count("cpu_number") > 0)
+    {
+      const auto& number = attributes["cpu_number"];
+      cpu_number = _lgf_number<long>(number.first, "cpu_number", in_file, number.second);
+      if (cpu_capacities.empty() == false && cpu_capacities.rbegin()->first >= cpu_number)
+	_lgf_error(in_file, cpu_line, "cpu id " +
+		   std::to_string(cpu_capacities.rbegin()->first) +
+		   " out of range of cpu_number " + std::to_string(cpu_number));
+    }
+  else
+    cpu_number = cpu_capacities.rbegin()->first + 1;
+  bool has_capacity = false;
+  float cpu_capacity = 0;
+  if (attributes.count("cpu_capacity") > 0)
+    {
+      const auto& capacity = attributes["cpu_capacity"];
+      cpu_capacity = _lgf_number<float>(capacity.first, "cpu_capacity",
+					in_file, capacity.second);
+      has_capacity = true;
+    }
+  for (long i = 0; i < cpu_number; i++)
+    {
+      auto it = cpu_capacities.find(i);
+      if (it != cpu_capacities.end())
+	inst.cpus.push_back(Cpu(i, it->second));
+      else if (has_capacity == true)
+	inst.cpus.push_back(Cpu(i, cpu_capacity));
+      else
+	throw std::runtime_error(in_file + ": no capacity for cpu " + std::to_string(i) +
+				 ", attribute 'cpu_capacity' not found");
+    }
+
+  // init topology: cost attributes without @topology put every cpu on
+  // its own core of a single NUMA node and socket
+  Topology::Costs costs = Topology::default_costs();
+  const char* cost_attrs[] = {"cost_smt", "cost_core", "cost_numa", "cost_socket"};
+  for (size_t l = 0; l < Topology::LEVELS; ++l)
+    if (attributes.count(cost_attrs[l]) > 0)
+      {
+	const auto& cost = attributes[cost_attrs[l]];
+	costs[l] = _lgf_number<long>(cost.first, cost_attrs[l], in_file, cost.second);
+	has_topology = true;
+      }
+  if (has_topology == true)
+    {
+      std::vector<size_t> groups[3];
+      for (long i = 0; i < cpu_number; i++)
+	{
+	  auto it = cpu_groups.find(i);
+	  if (cpu_groups.empty() == false && it == cpu_groups.end())
+	    throw std::runtime_error(in_file + ": cpu " + std::to_string(i) +
+				     " missing from @topology");
+	  for (size_t l = 0; l < 3; ++l)
+	    groups[l].push_back(it != cpu_groups.end() ? it->second[l] : (l == 0 ? i : 0));
+	}
+      if (cpu_groups.empty() == false && cpu_groups.rbegin()->first >= cpu_number)
+	throw std::runtime_error(in_file + ": @topology cpu id " +
+				 std::to_string(cpu_groups.rbegin()->first) +
+				 " out of range of cpu_number " + std::to_string(cpu_number));
+      std::shared_ptr<const Topology> topology;
+      try {
+	topology = std::make_shared<Topology>(groups[0], groups[1], groups[2], costs);
+      } catch (std::runtime_error& error) {
+	throw std::runtime_error(in_file + ": " + error.what());
+      }
+      for (auto& cpu : inst.cpus)
+	cpu.set_topology(topology);
+    }
+}
+
+
+#endif  // LGF_LOADER_H
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "embed-common.h"
+#include "lgf-loader.h"
+#include "module.h"
+
+using namespace lemon;
+
+
+// Mapping files list one module per line as `"<module name>" <cpu id>`;
+// empty lines and lines starting with '#' are skipped.
+
+inline std::vector<size_t> read_mapping(const std::string& in_file,
+					const SmartDigraph& g,
+					const std::vector<Module>& modules,
+					size_t cpu_num)
+{
+  // returns the cpu of every module, by node id
+  std::unordered_map<std::string_view, int> node_by_name;
+  for (const auto& module : modules)
+    node_by_name[module.name()] = g.id(module.node());
+
+  _MappedFile file(in_file);
+  _LgfTokenizer tok(file.begin(), file.end(), in_file);
+  std::vector<size_t> mapping(countNodes(g), UNMAPPED);
+  std::string_view name, cpu;
+  while (tok.next_line())
+    {
+      std::string_view extra;
+      if (!tok.next_token(name) || !tok.next_token(cpu) || tok.next_token(extra))
+	tok.error("expected a module name and a cpu id");
+      auto it = node_by_name.find(name);
+      if (it == node_by_name.end())
+	tok.error("unknown module '" + std::string(name) + "'");
+      long cpu_id = _lgf_number<long>(cpu, "cpu id", in_file, tok.line());
+      if (cpu_id < 0 || size_t(cpu_id) >= cpu_num)
+	tok.error("cpu id " + std::to_string(cpu_id) + " out of range");
+      if (mapping[it->second] != UNMAPPED)
+	tok.error("module '" + std::string(name) + "' mapped twice");
+      mapping[it->second] = cpu_id;
+    }
+
+  for (const auto& module : modules)
+    if (mapping[g.id(module.node())] == UNMAPPED)
+      throw std::runtime_error(in_file + ": module '" + module.name() + "' is not mapped");
+  return mapping;
+}
+
+
+inline void write_mapping(const std::string& out_file,
+			  const SmartDigraph& g,
+			  const std::vector<Module>& modules,
+			  const std::vector<size_t>& mapping)
+{
+  std::ofstream out(out_file);
+  if (!out)
+    throw std::runtime_error(out_file + ": cannot open for writing");
+  out << "# module cpu" << std::endl;
+  for (const auto& module : modules)
+    {
+      out << '"';
+      for (char c : module.name())
+	{
+	  if (c == '"' || c == '\\')
+	    out << '\\';
+	  out << c;
+	}
+      out << "\"\t" << mapping[g.id(module.node())] << '\n';
+    }
+  if (!out.flush())
+    throw std::runtime_error(out_file + ": write failed");
+}
+
+
+#endif  // MAPPING_H
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
+
+
+inline long get_peak_rss_kb()
+{
+  // peak resident set size of the process so far
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return usage.ru_maxrss;
+}
+
+
+struct PhaseMetrics
+{
+  std::string name;
+  size_t calls = 0;  // phases run on several threads are summed up
+  long time_us = 0;
+  long peak_rss_kb = 0;  // process peak at the end of the phase
+};
+
+
+class Metrics
+{
+  // per-phase wall time and peak memory, and event counters of the
+  // algorithms, in the order they were first recorded; recording is a
+  // no-op until enabled. Every member may be called from any thread: the
+  // records are guarded by a mutex, the enabled flag is atomic
+ public:
+  void enable() { enabled_.store(true, std::memory_order_relaxed); }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  void add_phase(const std::string& name, long time_us)
+  {
+    if (enabled() == false)
+      return;
+    long peak = get_peak_rss_kb();
+    std::lock_guard<std::mutex> guard(lock_);
+    PhaseMetrics& phase = _find(phases_, name);
+    ++phase.calls;
+    phase.time_us += time_us;
+    phase.peak_rss_kb = std::max(phase.peak_rss_kb, peak);
+  }
+
+  void add(const std::string& counter, long n)
+  {
+    // counters are accumulated by the callers and added once per call,
+    // the hot paths never take the lock
+    if (enabled() == false)
+      return;
+    std::lock_guard<std::mutex> guard(lock_);
+    _find(counters_, counter).second += n;
+  }
+
+  std::vector<PhaseMetrics> phases() const
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    return phases_;
+  }
+
+  std::vector<std::pair<std::string, long>> counters() const
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    return counters_;
+  }
+
+ private:
+  static PhaseMetrics& _find(std::vector<PhaseMetrics>& phases, const std::string& name)
+  {
+    for (auto& phase : phases)
+      if (phase.name == name)
+	return phase;
+    phases.push_back(PhaseMetrics());
+    phases.back().name = name;
+    return phases.back();
+  }
+
+  static std::pair<std::string, long>& _find(std::vector<std::pair<std::string, long>>& counters,
+					       const std::string& name)
+  {
+    for (auto& counter : counters)
+      if (counter.first == name)
+	return counter;
+    counters.push_back(std::make_pair(name, 0L));
+    return counters.back();
+  }
+
+  std::atomic<bool> enabled_{false};
+  mutable std::mutex lock_;
+  std::vector<PhaseMetrics> phases_;
+  std::vector<std::pair<std::string, long>> counters_;
+};
+
+
+inline long elapsed_us(std::chrono::steady_clock::time_point since)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - since).count();
+}
+
+
+inline Metrics& metrics()
+{
+  // the metrics of the process
+  static Metrics instance;
+  return instance;
+}
+
+
+class MetricsPhase
+{
+  // records the lifetime of the object as a phase, e.g.
+  //   { MetricsPhase phase("load"); ... }
+ public:
+  MetricsPhase(const std::string& name)
+    : name_(name), start_(std::chrono::steady_clock::now()) {}
+
+  ~MetricsPhase()
+  {
+    metrics().add_phase(name_, elapsed_us(start_));
+  }
+
+  MetricsPhase(const MetricsPhase&) = delete;
+  MetricsPhase& operator=(const MetricsPhase&) = delete;
+
+ private:
+  std::string name_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+
+#endif  // METRICS_H
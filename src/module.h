@@ -44,7 +44,7 @@ class Module
   lemon::SmartDigraph::Node node_;
 };
 
-std::ostream& operator<<(std::ostream& out, const Module& m)
+inline std::ostream& operator<<(std::ostream& out, const Module& m)
 {
   return out << m.name() << ":  (" << m.weight() << ")";
 }
@@ -0,0 +1,582 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "embed.h"
+#include "embed-common.h"
+#include "instance.h"
+#include "metrics.h"
+#include "utils.h"
+
+using namespace lemon;
+
+
+struct ReportOptions
+{
+  // output format of the results (org or json); quiet reports only the
+  // mapping and the summary statistics
+  std::string format = "org";
+  bool quiet = false;
+  bool metrics = false;  // append the recorded metrics
+};
+
+
+class JsonWriter
+{
+  // streams a JSON document to an ostream as it is produced, inserting
+  // the commas between members
+ public:
+  JsonWriter(std::ostream& out) : out_(out) {}
+
+  JsonWriter& begin_object() { return _open('{'); }
+  JsonWriter& end_object() { return _close('}'); }
+  JsonWriter& begin_array() { return _open('['); }
+  JsonWriter& end_array() { return _close(']'); }
+
+  JsonWriter& key(const std::string& k)
+  {
+    _separate();
+    _write(k);
+    out_ << ':';
+    has_key_ = true;
+    return *this;
+  }
+
+  template<typename T>
+  JsonWriter& value(const T& v)
+  {
+    _separate();
+    _write(v);
+    return *this;
+  }
+
+  template<typename T>
+  JsonWriter& field(const std::string& k, const T& v)
+  {
+    return key(k).value(v);
+  }
+
+ private:
+  JsonWriter& _open(char c)
+  {
+    _separate();
+    out_ << c;
+    first_.push_back(true);
+    return *this;
+  }
+
+  JsonWriter& _close(char c)
+  {
+    first_.pop_back();
+    out_ << c;
+    return *this;
+  }
+
+  void _separate()
+  {
+    // a value right after its key needs no comma
+    if (has_key_)
+      {
+	has_key_ = false;
+	return;
+      }
+    if (first_.empty() == false)
+      {
+	if (first_.back() == false)
+	  out_ << ',';
+	first_.back() = false;
+      }
+  }
+
+  void _write(const std::string& v)
+  {
+    // most names need no escaping, write them without a copy
+    bool plain = std::none_of(v.begin(), v.end(), [](char c) {
+	return c == '"' || c == '\\' || (unsigned char) c < 0x20;
+      });
+    if (plain)
+      out_ << '"' << v << '"';
+    else
+      out_ << json_string(v);
+  }
+  void _write(const char* v) { _write(std::string(v)); }
+  void _write(bool v) { out_ << (v ? "true" : "false"); }
+
+  template<typename T>
+  void _write(T v)
+  {
+    static_assert(std::is_arithmetic<T>::value, "JSON values are numbers or strings");
+    if constexpr (std::is_floating_point<T>::value)
+      {
+	if (std::isfinite(v) == false)
+	  {
+	    out_ << "null";
+	    return;
+	  }
+      }
+    out_ << v;
+  }
+
+  std::ostream& out_;
+  std::vector<bool> first_;  // no member written yet, per open level
+  bool has_key_ = false;
+};
+
+
+template<typename T>
+struct Summary
+{
+  // aggregates of a per-flow or per-cpu quantity
+  float sum = 0;
+  T min = 0;
+  T max = 0;
+  float avg = 0;
+  float std_dev = 0;
+};
+
+template<typename T>
+Summary<T> summarize(const std::vector<T>& values)
+{
+  Summary<T> s;
+  if (values.empty())
+    return s;
+  s.sum = std::accumulate(values.begin(), values.end(), 0.0);
+  s.min = *std::min_element(values.begin(), values.end());
+  s.max = *std::max_element(values.begin(), values.end());
+  s.avg = s.sum / values.size();
+  s.std_dev = calc_stdev<T>(values, s.sum);
+  return s;
+}
+
+
+struct EmbedReport
+{
+  // statistics of an embedding, for either output format
+  std::vector<FlowStat> flow_stats;
+  Summary<size_t> flow_cpus;
+  Summary<size_t> crossings;
+  Summary<size_t> costs;  // with a topology
+  Summary<long> traffic;  // with flow rates
+  Summary<float> loads;
+  float capacity = 0;
+  bool has_cost = false;
+  bool has_rate = false;
+};
+
+
+inline EmbedReport get_embed_report(const Instance& inst, const EmbeddingResult& res)
+{
+  // cpus are expected to hold their modules of the mapping
+  EmbedReport r;
+  FlowPaths paths(inst.dfg, inst.flows);
+  const Topology* topology = get_topology(inst.cpus);
+  r.has_cost = (topology != nullptr);
+  r.has_rate = paths.weighted();
+
+  std::vector<size_t> flow_cpus, crossings, costs;
+  std::vector<long> traffic;
+  // flows of the same path share their statistics, up to the rate
+  std::vector<FlowStat> class_stats;
+  for (size_t c = 0; c < paths.size(); ++c)
+    class_stats.push_back(FlowStat(paths, c, res, topology));
+  r.flow_stats.reserve(inst.flows.size());
+  for (size_t f = 0; f < inst.flows.size(); ++f)
+    {
+      const Flow& flow = inst.flows[f];
+      r.flow_stats.push_back(class_stats[paths.flow_class(f)].for_flow(flow.name(),
+								       flow.rate()));
+      const FlowStat& fs = r.flow_stats.back();
+      flow_cpus.push_back(fs.cpus);
+      crossings.push_back(fs.crossings);
+      costs.push_back(fs.cost);
+      traffic.push_back(fs.traffic);
+    }
+  r.flow_cpus = summarize(flow_cpus);
+  r.crossings = summarize(crossings);
+  if (r.has_cost)
+    r.costs = summarize(costs);
+  if (r.has_rate)
+    r.traffic = summarize(traffic);
+
+  std::vector<float> loads;
+  for (const auto& cpu : inst.cpus)
+    {
+      loads.push_back(cpu.load());
+      r.capacity += cpu.capacity();
+    }
+  r.loads = summarize(loads);
+  return r;
+}
+
+
+template<typename T>
+void _print_summary_org(std::ostream& out, const std::string& title, const Summary<T>& s)
+{
+  out << "** " << title << '\n'
+      << "sum: " << s.sum << '\n'
+      << "min: " << s.min << '\n'
+      << "max: " << s.max << '\n'
+      << "avg: " << s.avg << '\n'
+      << "std_dev: " << s.std_dev << '\n'
+      << '\n';
+}
+
+template<typename T>
+void _print_summary_json(JsonWriter& json, const std::string& title, const Summary<T>& s)
+{
+  json.key(title).begin_object()
+    .field("sum", s.sum)
+    .field("min", s.min)
+    .field("max", s.max)
+    .field("avg", s.avg)
+    .field("std_dev", s.std_dev)
+    .end_object();
+}
+
+
+inline void print_metrics_json(JsonWriter& json, const Metrics& m)
+{
+  // phases in the order they first finished (nested phases before the
+  // enclosing one), then the counters
+  json.begin_object()
+    .key("phases").begin_array();
+  for (const auto& phase : m.phases())
+    json.begin_object()
+      .field("name", phase.name)
+      .field("calls", phase.calls)
+      .field("time_us", phase.time_us)
+      .field("peak_rss_kb", phase.peak_rss_kb)
+      .end_object();
+  json.end_array()
+    .key("counters").begin_object();
+  for (const auto& counter : m.counters())
+    json.field(counter.first, counter.second);
+  json.end_object()
+    .field("peak_rss_kb", get_peak_rss_kb())
+    .end_object();
+}
+
+
+inline void print_report_org(std::ostream& out,
+			     const Instance& inst,
+			     const EmbeddingResult& res,
+			     const EmbedStat& stat,
+			     const EmbedOptions& opts,
+			     const ReembedOptions* reembed_opts,
+			     long time_us,
+			     const ReportOptions& report_opts = ReportOptions())
+{
+  // the human readable (org-mode) report; reembed_opts is set when
+  // re-embedding
+  const SmartDigraph& dfg = inst.dfg;
+  const bool quiet = report_opts.quiet;
+  EmbedReport r = get_embed_report(inst, res);
+
+  if (quiet == false)
+    {
+      out << '\n' << "* Modules" << '\n';
+      for (const auto& module : inst.modules)
+	out << module << " [" << dfg.id(module.node()) << "]" << '\n';
+
+      out << '\n' << "* Flows" << '\n';
+      for (const auto& f : inst.flows)
+	out << f << '\n';
+    }
+
+  out << '\n' << "* CPUs" << '\n';
+  for (const auto& c : inst.cpus)
+    out << c << '\n';
+
+  out << '\n' << "* Objective function"
+      << '\n' << "value: " << res.sol_value << '\n';
+  if (res.gap >= 0)
+    out << "gap: " << res.gap << '\n';
+
+  out << '\n' << "* Flow stats" << '\n';
+  if (quiet == false)
+    for (const auto& fs : r.flow_stats)
+      out << fs << '\n';
+  out << '\n';
+  _print_summary_org(out, "cpus", r.flow_cpus);
+  _print_summary_org(out, "crossings", r.crossings);
+  if (r.has_cost)
+    _print_summary_org(out, "crossing cost", r.costs);
+  if (r.has_rate)
+    _print_summary_org(out, "traffic", r.traffic);
+
+  out << '\n' << "* CPU stats" << '\n';
+  out << '\n' << "** load" << '\n'
+      << "available: " << r.capacity << '\n'
+      << "sum: " << r.loads.sum << '\n'
+      << "min: " << r.loads.min << '\n'
+      << "max: " << r.loads.max << '\n'
+      << "avg: " << r.loads.avg << '\n'
+      << "std_dev: " << r.loads.std_dev << '\n'
+      << '\n';
+
+  // a rejected instance never gets here, the error names the violated
+  // bound; the bounds of a feasible one are metrics
+  if (report_opts.metrics == true)
+    out << "* Presolve" << '\n'
+	<< "min cpus: " << stat.presolve.min_cpus << '\n'
+	<< "largest clique: " << stat.presolve.largest_clique << '\n'
+	<< "total weight: " << stat.presolve.total_weight << '\n'
+	<< "free capacity: " << stat.presolve.total_capacity << '\n'
+	<< '\n';
+
+  const MultiStartStat& multistart_stat = stat.multistart;
+  if (multistart_stat.values.size() > 1)
+    {
+      Summary<long> values = summarize(multistart_stat.values);
+      out << "* Multi-start" << '\n'
+	  << "starts: " << multistart_stat.values.size() + multistart_stat.failed << '\n'
+	  << "failed: " << multistart_stat.failed << '\n'
+	  << "threads: " << multistart_stat.threads << '\n'
+	  << "best seed: " << multistart_stat.best_seed << '\n'
+	  << "min: " << values.min << '\n'
+	  << "max: " << values.max << '\n'
+	  << "avg: " << values.avg << '\n'
+	  << "std_dev: " << values.std_dev << '\n'
+	  << '\n';
+    }
+
+  if (reembed_opts != nullptr)
+    {
+      out << "* Re-embedding" << '\n'
+	  << "failed cpus: ";
+      for (size_t i = 0; i < reembed_opts->failed.size(); ++i)
+	out << (i ? "," : "") << reembed_opts->failed[i];
+      out << '\n'
+	  << "previous value: " << stat.reembed.previous_value << '\n'
+	  << "displaced: " << stat.reembed.displaced << '\n'
+	  << "migrated: " << stat.reembed.migrated << '\n'
+	  << '\n';
+    }
+
+  if (opts.decompose == true)
+    out << "* Decomposition" << '\n'
+	<< "components: " << stat.decompose.components << '\n'
+	<< "parts: " << stat.decompose.parts << '\n'
+	<< "resolved: " << stat.decompose.resolved << '\n'
+	<< "undecomposed: " << stat.decompose.undecomposed << '\n'
+	<< '\n';
+
+  if (opts.refine == true)
+    out << "* Refinement" << '\n'
+	<< "initial value: " << stat.refine.initial_value << '\n'
+	<< "final value: " << stat.refine.final_value << '\n'
+	<< "iterations: " << stat.refine.iterations << '\n'
+	<< "accepted: " << stat.refine.accepted << '\n'
+	<< '\n';
+
+  if (report_opts.metrics == true)
+    {
+      JsonWriter json(out);
+      out << "* Metrics" << '\n';
+      print_metrics_json(json, metrics());
+      out << '\n' << '\n';
+    }
+
+  out << "* Execution time" << '\n'
+      << time_us << " us" << '\n' << std::endl;
+}
+
+
+inline void print_report_json(std::ostream& out,
+			      const Instance& inst,
+			      const EmbeddingResult& res,
+			      const EmbedStat& stat,
+			      const EmbedOptions& opts,
+			      const ReembedOptions* reembed_opts,
+			      long time_us,
+			      const ReportOptions& report_opts = ReportOptions())
+{
+  // the report as one JSON object, streamed; the mapping lists the cpu of
+  // every module by node id
+  const SmartDigraph& dfg = inst.dfg;
+  const bool quiet = report_opts.quiet;
+  EmbedReport r = get_embed_report(inst, res);
+  JsonWriter json(out);
+  json.begin_object();
+
+  if (quiet == false)
+    {
+      json.key("modules").begin_array();
+      for (const auto& module : inst.modules)
+	json.begin_object()
+	  .field("id", dfg.id(module.node()))
+	  .field("name", module.name())
+	  .field("weight", module.weight())
+	  .field("cpu", res.mapping[dfg.id(module.node())])
+	  .end_object();
+      json.end_array();
+
+      json.key("flows").begin_array();
+      for (size_t f = 0; f < inst.flows.size(); ++f)
+	{
+	  const FlowStat& fs = r.flow_stats[f];
+	  json.begin_object()
+	    .field("name", inst.flows[f].name())
+	    .key("modules").begin_array();
+	  for (const auto& module : inst.flows[f].modules())
+	    json.value(module.name());
+	  json.end_array()
+	    .field("crossings", fs.crossings)
+	    .field("cpus", fs.cpus);
+	  if (r.has_cost)
+	    json.field("cost", fs.cost);
+	  if (r.has_rate)
+	    json.field("rate", fs.rate).field("traffic", fs.traffic);
+	  json.end_object();
+	}
+      json.end_array();
+
+      json.key("cpus").begin_array();
+      for (const auto& c : inst.cpus)
+	{
+	  json.begin_object()
+	    .field("id", c.id())
+	    .field("capacity", c.capacity())
+	    .field("load", c.load())
+	    .key("modules").begin_array();
+	  for (const auto& module : c.modules())
+	    json.value(module.name());
+	  json.end_array().end_object();
+	}
+      json.end_array();
+    }
+
+  json.key("mapping").begin_array();
+  for (size_t cpu : res.mapping)
+    json.value(cpu);
+  json.end_array();
+
+  json.key("objective").begin_object()
+    .field("value", res.sol_value);
+  if (res.gap >= 0)
+    json.field("gap", res.gap);
+  json.end_object();
+
+  json.key("flow_stats").begin_object();
+  _print_summary_json(json, "cpus", r.flow_cpus);
+  _print_summary_json(json, "crossings", r.crossings);
+  if (r.has_cost)
+    _print_summary_json(json, "crossing_cost", r.costs);
+  if (r.has_rate)
+    _print_summary_json(json, "traffic", r.traffic);
+  json.end_object();
+
+  json.key("cpu_stats").begin_object()
+    .field("available", r.capacity);
+  _print_summary_json(json, "load", r.loads);
+  json.end_object();
+
+  json.key("presolve").begin_object()
+    .field("min_cpus", stat.presolve.min_cpus)
+    .field("largest_clique", stat.presolve.largest_clique)
+    .field("total_weight", stat.presolve.total_weight)
+    .field("free_capacity", stat.presolve.total_capacity)
+    .end_object();
+
+  const MultiStartStat& multistart_stat = stat.multistart;
+  if (multistart_stat.values.size() > 1)
+    {
+      Summary<long> values = summarize(multistart_stat.values);
+      json.key("multistart").begin_object()
+	.field("starts", multistart_stat.values.size() + multistart_stat.failed)
+	.field("failed", multistart_stat.failed)
+	.field("threads", multistart_stat.threads)
+	.field("best_seed", multistart_stat.best_seed)
+	.field("min", values.min)
+	.field("max", values.max)
+	.field("avg", values.avg)
+	.field("std_dev", values.std_dev)
+	.end_object();
+    }
+
+  if (reembed_opts != nullptr)
+    {
+      json.key("reembed").begin_object()
+	.key("failed").begin_array();
+      for (size_t cpu : reembed_opts->failed)
+	json.value(cpu);
+      json.end_array()
+	.field("previous_value", stat.reembed.previous_value)
+	.field("displaced", stat.reembed.displaced)
+	.field("migrated", stat.reembed.migrated)
+	.end_object();
+    }
+
+  if (opts.decompose == true)
+    json.key("decompose").begin_object()
+      .field("components", stat.decompose.components)
+      .field("parts", stat.decompose.parts)
+      .field("resolved", stat.decompose.resolved)
+      .field("undecomposed", stat.decompose.undecomposed)
+      .end_object();
+
+  if (opts.refine == true)
+    json.key("refine").begin_object()
+      .field("initial_value", stat.refine.initial_value)
+      .field("final_value", stat.refine.final_value)
+      .field("iterations", stat.refine.iterations)
+      .field("accepted", stat.refine.accepted)
+      .end_object();
+
+  if (report_opts.metrics == true)
+    {
+      json.key("metrics");
+      print_metrics_json(json, metrics());
+    }
+
+  json.field("time_us", time_us);
+  json.end_object();
+  out << std::endl;
+}
+
+
+inline void print_report(std::ostream& out,
+			 const Instance& inst,
+			 const EmbeddingResult& res,
+			 const EmbedStat& stat,
+			 const EmbedOptions& opts,
+			 const ReembedOptions* reembed_opts,
+			 long time_us,
+			 const ReportOptions& report_opts)
+{
+  if (report_opts.format == "org")
+    print_report_org(out, inst, res, stat, opts, reembed_opts, time_us, report_opts);
+  else if (report_opts.format == "json")
+    print_report_json(out, inst, res, stat, opts, reembed_opts, time_us, report_opts);
+  else
+    throw std::runtime_error("Invalid output format");
+}
+
+
+#endif  // REPORT_H
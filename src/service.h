@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "embed.h"
+#include "embed-common.h"
+#include "instance.h"
+#include "utils.h"
+
+
+// Line protocol: one request per line, a command followed by key=value
+// arguments; one JSON object per reply line.
+//   embed [method=.. maxflow=0|1 starts=.. threads=.. seed=.. timelimit=..
+//          mipgap=.. warmstart=.. refine=0|1 refineiters=.. refinetime=..
+//          decompose=0|1]
+//   reembed failed=<cpu,..> [budget=..] [embed arguments]
+//   weight <module>=<weight> ..
+//   mapping | modules | info | quit | shutdown
+// embed and reembed replace the current mapping, which reembed starts
+// from; the failed cpus of a reembed stay disabled for every later
+// request; mappings are cpu ids listed by module node id (see modules).
+
+class EmbedService
+{
+ public:
+  EmbedService(Instance& inst, const EmbedOptions& defaults)
+    : inst_(inst), defaults_(defaults)
+  {
+    for (const auto& module : inst_.modules)
+      node_by_name_[module.name()] = inst_.dfg.id(module.node());
+  }
+
+  std::string handle(const std::string& line, bool& quit, bool& shutdown)
+  {
+    // executes a request, errors are reported in the reply
+    quit = false;
+    shutdown = false;
+    std::istringstream ss(line);
+    std::string cmd;
+    if (!(ss >> cmd))
+      return "";
+    std::vector<std::pair<std::string, std::string>> args;
+    std::string arg;
+    while (ss >> arg)
+      {
+	size_t eq = arg.find('=');
+	if (eq == std::string::npos)
+	  return _error("invalid argument '" + arg + "'");
+	args.push_back(std::make_pair(arg.substr(0, eq), arg.substr(eq + 1)));
+      }
+
+    try {
+      if (cmd == "embed" || cmd == "reembed")
+	return _embed(cmd == "reembed", args);
+      if (cmd == "weight")
+	return _weight(args);
+      if (cmd == "mapping")
+	return "{\"status\":\"ok\",\"mapping\":" + _mapping_json() + "}";
+      if (cmd == "modules")
+	{
+	  std::vector<std::string> names(countNodes(inst_.dfg));
+	  for (const auto& module : inst_.modules)
+	    names[inst_.dfg.id(module.node())] = module.name();
+	  std::string retval = "{\"status\":\"ok\",\"modules\":[";
+	  for (size_t i = 0; i < names.size(); ++i)
+	    retval += (i ? "," : "") + json_string(names[i]);
+	  return retval + "]}";
+	}
+      if (cmd == "info")
+	return "{\"status\":\"ok\",\"modules\":" + std::to_string(inst_.modules.size()) +
+	  ",\"flows\":" + std::to_string(inst_.flows.size()) +
+	  ",\"conflicts\":" + std::to_string(countEdges(inst_.cg)) +
+	  ",\"cpus\":" + std::to_string(inst_.cpus.size()) +
+	  ",\"capacities\":" + _capacities_json() +
+	  ",\"disabled\":" + _cpus_json(disabled_) +
+	  ",\"mapped\":" + (mapping_.empty() ? "false" : "true") + "}";
+      if (cmd == "quit" || cmd == "shutdown")
+	{
+	  quit = true;
+	  shutdown = (cmd == "shutdown");
+	  return "{\"status\":\"ok\"}";
+	}
+    } catch (std::exception& error) {
+      return _error(error.what());
+    }
+    return _error("unknown command '" + cmd + "'");
+  }
+
+ private:
+  static std::string _error(const std::string& msg)
+  {
+    return "{\"status\":\"error\",\"message\":" + json_string(msg) + "}";
+  }
+
+  static std::string _cpus_json(const std::vector<size_t>& cpus)
+  {
+    std::string retval = "[";
+    for (size_t i = 0; i < cpus.size(); ++i)
+      retval += (i ? "," : "") + std::to_string(cpus[i]);
+    return retval + "]";
+  }
+
+  std::string _mapping_json() const
+  {
+    return _cpus_json(mapping_);
+  }
+
+  std::string _capacities_json() const
+  {
+    std::ostringstream retval;
+    retval << "[";
+    for (size_t i = 0; i < inst_.cpus.size(); ++i)
+      retval << (i ? "," : "") << inst_.cpus[i].capacity();
+    retval << "]";
+    return retval.str();
+  }
+
+  std::string _embed(bool reembed,
+		     const std::vector<std::pair<std::string, std::string>>& args)
+  {
+    EmbedOptions opts = defaults_;
+    ReembedOptions reembed_opts;
+    for (const auto& a : args)
+      {
+	const std::string& k = a.first;
+	const std::string& v = a.second;
+	try {
+	  if (k == "method")
+	    {
+	      opts.method = v;
+	      for (auto& c : opts.method)
+	        c = std::tolower(c);
+	    }
+	  else if (k == "maxflow")
+	    opts.max_obj_func = _flag(v);
+	  else if (k == "starts")
+	    opts.starts = std::stoi(v);
+	  else if (k == "threads")
+	    opts.threads = std::stoi(v);
+	  else if (k == "seed")
+	    opts.seed = std::stoul(v);
+	  else if (k == "timelimit")
+	    opts.time_limit = std::stod(v);
+	  else if (k == "mipgap")
+	    opts.mip_gap = std::stod(v);
+	  else if (k == "warmstart")
+	    opts.warm_start = v;
+	  else if (k == "refine")
+	    opts.refine = _flag(v);
+	  else if (k == "refineiters")
+	    opts.refine_iters = std::stoi(v);
+	  else if (k == "refinetime")
+	    opts.refine_time = std::stoi(v);
+	  else if (k == "decompose")
+	    opts.decompose = _flag(v);
+	  else if (k == "failed" && reembed)
+	    for (const auto& cpu : split_string_to_vec(v))
+	      reembed_opts.failed.push_back(std::stoul(cpu));
+	  else if (k == "budget" && reembed)
+	    reembed_opts.budget = std::stol(v);
+	  else
+	    throw std::runtime_error("unknown argument '" + k + "'");
+	} catch (std::logic_error&) {
+	  throw std::runtime_error("invalid value '" + v + "' of '" + k + "'");
+	}
+      }
+    if (reembed && mapping_.empty())
+      throw std::runtime_error("no mapping to re-embed, run embed first");
+    // cpus failed earlier stay out of service
+    opts.disabled_cpus = disabled_;
+    for (size_t cpu : disabled_)
+      if (std::find(reembed_opts.failed.begin(), reembed_opts.failed.end(), cpu) ==
+	  reembed_opts.failed.end())
+	reembed_opts.failed.push_back(cpu);
+
+    auto t_before = std::chrono::steady_clock::now();
+    EmbedStat stat;
+    EmbeddingResult res;
+    if (reembed)
+      res = reembed_with_method(inst_.dfg, inst_.cg, inst_.cpus, inst_.flows, inst_.modules,
+				mapping_, opts, reembed_opts, &stat);
+    else
+      res = embed_with_method(inst_.dfg, inst_.cg, inst_.cpus, inst_.flows, inst_.modules,
+			      opts, &stat);
+    auto t_after = std::chrono::steady_clock::now();
+    mapping_ = res.mapping;
+    if (reembed)
+      {
+	disabled_ = reembed_opts.failed;
+	std::sort(disabled_.begin(), disabled_.end());
+      }
+
+    std::string retval = "{\"status\":\"ok\",\"value\":" + std::to_string(res.sol_value);
+    if (res.gap >= 0)
+      retval += ",\"gap\":" + std::to_string(res.gap);
+    retval += ",\"time_us\":" + std::to_string(
+      std::chrono::duration_cast<std::chrono::microseconds>(t_after - t_before).count());
+    if (reembed)
+      retval += ",\"displaced\":" + std::to_string(stat.reembed.displaced) +
+	",\"migrated\":" + std::to_string(stat.reembed.migrated);
+    return retval + ",\"mapping\":" + _mapping_json() + "}";
+  }
+
+  std::string _weight(const std::vector<std::pair<std::string, std::string>>& args)
+  {
+    std::vector<float> weights(countNodes(inst_.dfg), 0);
+    for (const auto& module : inst_.modules)
+      weights[inst_.dfg.id(module.node())] = module.weight();
+    // all weights are checked before any of them is applied
+    for (const auto& a : args)
+      {
+	auto it = node_by_name_.find(a.first);
+	if (it == node_by_name_.end())
+	  throw std::invalid_argument("unknown module '" + a.first + "'");
+	float w = -1;
+	size_t len = 0;
+	try {
+	  w = std::stof(a.second, &len);
+	} catch (std::logic_error&) {
+	  len = 0;
+	}
+	if (len != a.second.size() || std::isfinite(w) == false || w < 0)
+	  throw std::invalid_argument("invalid weight '" + a.second + "' of '" +
+				      a.first + "'");
+	weights[it->second] = w;
+      }
+    update_module_weights(inst_, weights);
+    return "{\"status\":\"ok\",\"updated\":" + std::to_string(args.size()) + "}";
+  }
+
+  static bool _flag(const std::string& v)
+  {
+    if (v == "1" || v == "true")
+      return true;
+    if (v == "0" || v == "false")
+      return false;
+    throw std::invalid_argument("invalid flag value '" + v + "'");
+  }
+
+  Instance& inst_;
+  EmbedOptions defaults_;
+  std::unordered_map<std::string, int> node_by_name_;
+  std::vector<size_t> mapping_;  // current mapping, by node id
+  std::vector<size_t> disabled_;  // failed cpus of the earlier reembeds
+};
+
+
+inline void serve_stdio(EmbedService& service, std::istream& in, std::ostream& out)
+{
+  std::string line;
+  bool quit = false, shutdown = false;
+  while (quit == false && std::getline(in, line))
+    {
+      std::string reply = service.handle(line, quit, shutdown);
+      if (reply.empty() == false)
+	out << reply << std::endl;
+    }
+}
+
+
+inline void serve_unix_socket(EmbedService& service, const std::string& path)
+{
+  // serves one client at a time until a shutdown request
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    throw std::runtime_error(path + ": socket path too long");
+  std::strcpy(addr.sun_path, path.c_str());
+
+  // only a stale socket is replaced, never any other file
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0)
+    {
+      if (S_ISSOCK(st.st_mode) == false)
+	throw std::runtime_error(path + ": exists and is not a socket");
+      if (unlink(path.c_str()) != 0)
+	throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+  else if (errno != ENOENT)
+    throw std::runtime_error(path + ": " + std::strerror(errno));
+
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0)
+    throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+  if (bind(server, (sockaddr*) &addr, sizeof(addr)) != 0 ||
+      lstat(path.c_str(), &st) != 0 || listen(server, 8) != 0)
+    {
+      close(server);
+      throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+  // the socket file this process created, to be removed on shutdown
+  const dev_t dev = st.st_dev;
+  const ino_t ino = st.st_ino;
+  std::signal(SIGPIPE, SIG_IGN);
+
+  bool shutdown = false;
+  while (shutdown == false)
+    {
+      int client = accept(server, nullptr, nullptr);
+      if (client < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  break;
+	}
+      std::string buf;
+      char chunk[65536];
+      bool quit = false;
+      ssize_t n;
+      while (quit == false && (n = read(client, chunk, sizeof(chunk))) > 0)
+	{
+	  buf.append(chunk, n);
+	  size_t nl;
+	  while (quit == false && (nl = buf.find('\n')) != std::string::npos)
+	    {
+	      std::string reply = service.handle(buf.substr(0, nl), quit, shutdown);
+	      buf.erase(0, nl + 1);
+	      if (reply.empty())
+		continue;
+	      reply += '\n';
+	      for (size_t sent = 0; sent < reply.size(); )
+		{
+		  ssize_t k = send(client, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+		  if (k <= 0)
+		    {
+		      quit = true;
+		      break;
+		    }
+		  sent += k;
+		}
+	    }
+	}
+      close(client);
+    }
+  close(server);
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) &&
+      st.st_dev == dev && st.st_ino == ino)
+    unlink(path.c_str());
+}
+
+
+#endif  // SERVICE_H
@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <lemon/smart_graph.h>
+
+#include "cpu.h"
+#include "flow.h"
+#include "instance.h"
+#include "lgf-loader.h"
+#include "module.h"
+
+using namespace lemon;
+
+
+// Binary instance snapshot, native endianness, every array 8-byte aligned:
+//   header
+//   float    weight[nodes]
+//   uint64   name_offset[nodes + 1], char names[]         (module names)
+//   int32    arc[arcs][2]                                 (source, target)
+//   uint64   flow_offset[flows + 1], int32 flow_node[]    (flow paths)
+//   uint64   flow_name_offset[flows + 1], char flow_names[]
+//   int32    conflict[conflicts][2]                       (cg edges)
+//   float    cpu_capacity[cpus]
+//   int64    topology_cost[4], uint64 cpu_group[cpus][3]  (if has_topology:
+//            crossing costs, and core, NUMA node, socket per cpu)
+//   int64    flow_rate[flows]                             (if has_rates)
+// Node ids are the dfg (and cg) node ids; modules are implied by the
+// nodes, in NodeIt order.
+
+const char SNAPSHOT_MAGIC[8] = {'D', 'F', 'G', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t SNAPSHOT_VERSION = 3;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+
+struct _SnapshotHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t nodes;
+  uint64_t arcs;
+  uint64_t flows;
+  uint64_t flow_nodes;
+  uint64_t conflicts;
+  uint64_t has_conflicts;
+  uint64_t cpus;
+  uint64_t has_topology;
+  uint64_t has_rates;
+  uint64_t name_bytes;
+  uint64_t flow_name_bytes;
+};
+
+
+inline uint64_t _snapshot_align(uint64_t size) { return (size + 7) & ~uint64_t(7); }
+
+
+template<typename T>
+const T* _snapshot_array(const char* base, uint64_t offset)
+{
+  return reinterpret_cast<const T*>(base + offset);
+}
+
+
+struct _SnapshotLayout
+{
+  // byte offsets of the arrays, derived from the header counts
+  uint64_t weights, name_offsets, names, arcs, flow_offsets, flow_nodes,
+    flow_name_offsets, flow_names, conflicts, cpus, topology_costs, cpu_groups,
+    flow_rates, size;
+
+  _SnapshotLayout(const _SnapshotHeader& h)
+  {
+    uint64_t pos = sizeof(_SnapshotHeader);
+    auto take = [&pos](uint64_t bytes) {
+      uint64_t at = pos;
+      pos += _snapshot_align(bytes);
+      return at;
+    };
+    weights = take(h.nodes * sizeof(float));
+    name_offsets = take((h.nodes + 1) * sizeof(uint64_t));
+    names = take(h.name_bytes);
+    arcs = take(h.arcs * 2 * sizeof(int32_t));
+    flow_offsets = take((h.flows + 1) * sizeof(uint64_t));
+    flow_nodes = take(h.flow_nodes * sizeof(int32_t));
+    flow_name_offsets = take((h.flows + 1) * sizeof(uint64_t));
+    flow_names = take(h.flow_name_bytes);
+    conflicts = take(h.conflicts * 2 * sizeof(int32_t));
+    cpus = take(h.cpus * sizeof(float));
+    topology_costs = take(h.has_topology ? Topology::LEVELS * sizeof(int64_t) : 0);
+    cpu_groups = take(h.has_topology ? h.cpus * 3 * sizeof(uint64_t) : 0);
+    flow_rates = take(h.has_rates ? h.flows * sizeof(int64_t) : 0);
+    size = pos;
+  }
+};
+
+
+inline void save_instance_snapshot(const Instance& inst, const std::string& out_file)
+{
+  const SmartDigraph& dfg = inst.dfg;
+  const SmartGraph& cg = inst.cg;
+  const size_t node_num = countNodes(dfg);
+
+  std::vector<float> weights(node_num, 0);
+  std::vector<const std::string*> names(node_num, nullptr);
+  for (const auto& module : inst.modules)
+    {
+      weights[dfg.id(module.node())] = module.weight();
+      names[dfg.id(module.node())] = &module.name();
+    }
+  std::vector<uint64_t> name_offsets(1, 0);
+  std::string name_blob;
+  for (size_t i = 0; i < node_num; ++i)
+    {
+      if (names[i] != nullptr)
+	name_blob += *names[i];
+      name_offsets.push_back(name_blob.size());
+    }
+
+  std::vector<int32_t> arcs;
+  for (int a = 0; a <= dfg.maxArcId(); ++a)
+    {
+      SmartDigraph::Arc arc = dfg.arcFromId(a);
+      arcs.push_back(dfg.id(dfg.source(arc)));
+      arcs.push_back(dfg.id(dfg.target(arc)));
+    }
+
+  std::vector<uint64_t> flow_offsets(1, 0);
+  std::vector<int32_t> flow_nodes;
+  std::vector<uint64_t> flow_name_offsets(1, 0);
+  std::string flow_name_blob;
+  std::vector<int64_t> flow_rates;
+  bool has_rates = false;
+  for (const auto& flow : inst.flows)
+    {
+      flow_rates.push_back(flow.rate());
+      has_rates = has_rates || flow.rate() != 1;
+      for (const auto& module : flow.modules())
+	flow_nodes.push_back(dfg.id(module.node()));
+      flow_offsets.push_back(flow_nodes.size());
+      flow_name_blob += flow.name();
+      flow_name_offsets.push_back(flow_name_blob.size());
+    }
+
+  std::vector<int32_t> conflicts;
+  for (int e = 0; e <= cg.maxEdgeId(); ++e)
+    {
+      SmartGraph::Edge edge = cg.edgeFromId(e);
+      conflicts.push_back(cg.id(cg.u(edge)));
+      conflicts.push_back(cg.id(cg.v(edge)));
+    }
+
+  std::vector<float> capacities;
+  for (const auto& cpu : inst.cpus)
+    capacities.push_back(cpu.capacity());
+
+  const Topology* topology = inst.cpus.empty() ? nullptr : inst.cpus[0].topology();
+  std::vector<int64_t> topology_costs;
+  std::vector<uint64_t> cpu_groups;
+  if (topology != nullptr)
+    {
+      topology_costs.assign(topology->costs().begin(), topology->costs().end());
+      for (size_t i = 0; i < topology->size(); ++i)
+	{
+	  cpu_groups.push_back(topology->cores()[i]);
+	  cpu_groups.push_back(topology->numas()[i]);
+	  cpu_groups.push_back(topology->sockets()[i]);
+	}
+    }
+
+  _SnapshotHeader h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+  h.version = SNAPSHOT_VERSION;
+  h.byte_order = SNAPSHOT_BYTE_ORDER;
+  h.nodes = node_num;
+  h.arcs = arcs.size() / 2;
+  h.flows = inst.flows.size();
+  h.flow_nodes = flow_nodes.size();
+  h.conflicts = conflicts.size() / 2;
+  h.has_conflicts = countNodes(cg) > 0;
+  h.cpus = capacities.size();
+  h.has_topology = topology != nullptr;
+  h.has_rates = has_rates;
+  if (has_rates == false)
+    flow_rates.clear();
+  h.name_bytes = name_blob.size();
+  h.flow_name_bytes = flow_name_blob.size();
+
+  std::ofstream out(out_file, std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error(out_file + ": cannot open for writing");
+  const char zeros[8] = {0};
+  auto write = [&out, &zeros](const void* data, uint64_t bytes) {
+    out.write(static_cast<const char*>(data), bytes);
+    out.write(zeros, _snapshot_align(bytes) - bytes);
+  };
+  write(&h, sizeof(h));
+  write(weights.data(), weights.size() * sizeof(float));
+  write(name_offsets.data(), name_offsets.size() * sizeof(uint64_t));
+  write(name_blob.data(), name_blob.size());
+  write(arcs.data(), arcs.size() * sizeof(int32_t));
+  write(flow_offsets.data(), flow_offsets.size() * sizeof(uint64_t));
+  write(flow_nodes.data(), flow_nodes.size() * sizeof(int32_t));
+  write(flow_name_offsets.data(), flow_name_offsets.size() * sizeof(uint64_t));
+  write(flow_name_blob.data(), flow_name_blob.size());
+  write(conflicts.data(), conflicts.size() * sizeof(int32_t));
+  write(capacities.data(), capacities.size() * sizeof(float));
+  write(topology_costs.data(), topology_costs.size() * sizeof(int64_t));
+  write(cpu_groups.data(), cpu_groups.size() * sizeof(uint64_t));
+  write(flow_rates.data(), flow_rates.size() * sizeof(int64_t));
+  if (!out.flush())
+    throw std::runtime_error(out_file + ": write failed");
+}
+
+
+inline bool is_instance_snapshot(const std::string& in_file)
+{
+  std::ifstream in(in_file, std::ios::binary);
+  char magic[sizeof(SNAPSHOT_MAGIC)];
+  return in.read(magic, sizeof(magic)) &&
+    std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+}
+
+
+inline void load_instance_snapshot(Instance& inst, const std::string& in_file)
+{
+  // maps the snapshot and builds the instance straight from its arrays;
+  // all counts, offsets and node ids are checked against the file size
+  _MappedFile file(in_file);
+  const char* base = file.begin();
+  const uint64_t file_size = file.end() - file.begin();
+  auto fail = [&in_file](const std::string& msg) {
+    throw std::runtime_error(in_file + ": " + msg);
+  };
+
+  if (file_size < sizeof(_SnapshotHeader) ||
+      std::memcmp(base, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+    fail("not an instance snapshot");
+  const _SnapshotHeader& h = *reinterpret_cast<const _SnapshotHeader*>(base);
+  if (h.version != SNAPSHOT_VERSION)
+    fail("unsupported snapshot version " + std::to_string(h.version) +
+	 " (expected " + std::to_string(SNAPSHOT_VERSION) + ")");
+  if (h.byte_order != SNAPSHOT_BYTE_ORDER)
+    fail("snapshot written with a different byte order");
+  // bound the counts before computing the layout to avoid overflow
+  for (uint64_t count : {h.nodes, h.arcs, h.flows, h.flow_nodes, h.conflicts,
+			 h.cpus, h.name_bytes, h.flow_name_bytes, h.has_topology,
+			 h.has_rates})
+    if (count > file_size)
+      fail("truncated or corrupt snapshot");
+  _SnapshotLayout l(h);
+  if (l.size != file_size || h.nodes > INT32_MAX)
+    fail("truncated or corrupt snapshot");
+
+  const float* weights = _snapshot_array<float>(base, l.weights);
+  const uint64_t* name_offsets = _snapshot_array<uint64_t>(base, l.name_offsets);
+  const char* names = base + l.names;
+  const int32_t* arcs = _snapshot_array<int32_t>(base, l.arcs);
+  const uint64_t* flow_offsets = _snapshot_array<uint64_t>(base, l.flow_offsets);
+  const int32_t* flow_nodes = _snapshot_array<int32_t>(base, l.flow_nodes);
+  const uint64_t* flow_name_offsets = _snapshot_array<uint64_t>(base, l.flow_name_offsets);
+  const char* flow_names = base + l.flow_names;
+  const int32_t* conflicts = _snapshot_array<int32_t>(base, l.conflicts);
+  const float* capacities = _snapshot_array<float>(base, l.cpus);
+
+  auto check_offsets = [&fail](const uint64_t* offsets, uint64_t num, uint64_t total) {
+    if (offsets[0] != 0 || offsets[num] != total)
+      fail("corrupt snapshot offsets");
+    for (uint64_t i = 0; i < num; ++i)
+      if (offsets[i] > offsets[i+1])
+	fail("corrupt snapshot offsets");
+  };
+  check_offsets(name_offsets, h.nodes, h.name_bytes);
+  check_offsets(flow_offsets, h.flows, h.flow_nodes);
+  check_offsets(flow_name_offsets, h.flows, h.flow_name_bytes);
+  auto check_ids = [&fail, &h](const int32_t* ids, uint64_t num) {
+    for (uint64_t i = 0; i < num; ++i)
+      if (ids[i] < 0 || uint64_t(ids[i]) >= h.nodes)
+	fail("node id out of range");
+  };
+  check_ids(arcs, 2 * h.arcs);
+  check_ids(flow_nodes, h.flow_nodes);
+  check_ids(conflicts, 2 * h.conflicts);
+
+  SmartDigraph& dfg = inst.dfg;
+  dfg.reserveNode(h.nodes);
+  dfg.reserveArc(h.arcs);
+  for (uint64_t i = 0; i < h.nodes; ++i)
+    dfg.addNode();
+  for (uint64_t a = 0; a < h.arcs; ++a)
+    dfg.addArc(dfg.nodeFromId(arcs[2*a]), dfg.nodeFromId(arcs[2*a+1]));
+
+  if (h.has_conflicts != 0)
+    {
+      inst.cg.reserveNode(h.nodes);
+      inst.cg.reserveEdge(h.conflicts);
+      for (uint64_t i = 0; i < h.nodes; ++i)
+	inst.cg.addNode();
+      for (uint64_t e = 0; e < h.conflicts; ++e)
+	inst.cg.addEdge(inst.cg.nodeFromId(conflicts[2*e]),
+			inst.cg.nodeFromId(conflicts[2*e+1]));
+    }
+
+  std::vector<Module> module_by_id(h.nodes);
+  inst.modules.reserve(h.nodes);
+  for (SmartDigraph::NodeIt n(dfg); n != INVALID; ++n)
+    {
+      int id = dfg.id(n);
+      std::string name(names + name_offsets[id], name_offsets[id+1] - name_offsets[id]);
+      module_by_id[id] = Module(n, name, weights[id]);
+      inst.modules.push_back(module_by_id[id]);
+    }
+
+  const int64_t* flow_rates = _snapshot_array<int64_t>(base, l.flow_rates);
+  inst.flows.reserve(h.flows);
+  for (uint64_t f = 0; f < h.flows; ++f)
+    {
+      if (h.has_rates != 0 && flow_rates[f] < 0)
+	fail("negative flow rate");
+      std::vector<Module> path;
+      path.reserve(flow_offsets[f+1] - flow_offsets[f]);
+      for (uint64_t k = flow_offsets[f]; k < flow_offsets[f+1]; ++k)
+	path.push_back(module_by_id[flow_nodes[k]]);
+      inst.flows.push_back(Flow(std::string(flow_names + flow_name_offsets[f],
+					    flow_name_offsets[f+1] - flow_name_offsets[f]),
+				path, h.has_rates ? flow_rates[f] : 1));
+    }
+
+  for (uint64_t i = 0; i < h.cpus; ++i)
+    inst.cpus.push_back(Cpu(i, capacities[i]));
+
+  if (h.has_topology != 0)
+    {
+      const int64_t* costs = _snapshot_array<int64_t>(base, l.topology_costs);
+      const uint64_t* cpu_groups = _snapshot_array<uint64_t>(base, l.cpu_groups);
+      Topology::Costs topology_costs;
+      std::copy(costs, costs + Topology::LEVELS, topology_costs.begin());
+      std::vector<size_t> groups[3];
+      for (uint64_t i = 0; i < h.cpus; ++i)
+	for (size_t k = 0; k < 3; ++k)
+	  groups[k].push_back(cpu_groups[3*i + k]);
+      std::shared_ptr<const Topology> topology;
+      try {
+	topology = std::make_shared<Topology>(groups[0], groups[1], groups[2], topology_costs);
+      } catch (std::runtime_error& error) {
+	fail(error.what());
+      }
+      for (auto& cpu : inst.cpus)
+	cpu.set_topology(topology);
+    }
+}
+
+
+#endif  // SNAPSHOT_H
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+class Topology
+{
+  // hierarchical cpu topology: cpus sharing a core are SMT siblings,
+  // cores are grouped into NUMA nodes, NUMA nodes into sockets; a flow
+  // crossing between two cpus costs the cost of the smallest group they
+  // share (SMT: same core, CORE: same NUMA node, NUMA: same socket,
+  // SOCKET: none)
+ public:
+  enum Level { SMT, CORE, NUMA, SOCKET };
+  static const size_t LEVELS = 4;
+  typedef std::array<long, LEVELS> Costs;
+
+  // SMT siblings share the caches of their core: crossing between them
+  // is free unless the costs say otherwise
+  static Costs default_costs() { return Costs{{0, 1, 2, 4}}; }
+
+  Topology(const std::vector<size_t>& cores,
+	   const std::vector<size_t>& numas,
+	   const std::vector<size_t>& sockets,
+	   const Costs& costs = default_costs())
+    : costs_(costs)
+    {
+      const size_t n = cores.size();
+      if (numas.size() != n || sockets.size() != n)
+	throw std::runtime_error("topology: group lists of different size");
+      for (size_t l = 0; l < LEVELS; ++l)
+	if (costs_[l] < 0 || (l > 0 && costs_[l] < costs_[l-1]))
+	  throw std::runtime_error("topology: crossing costs must be non-negative "
+				   "and non-decreasing from SMT to socket level");
+      groups_[0] = cores;
+      groups_[1] = numas;
+      groups_[2] = sockets;
+
+      costs_by_pair_.assign(n * n, 0);
+      min_cost_ = costs_[SOCKET];
+      max_cost_ = 0;
+      for (size_t a = 0; a < n; ++a)
+	for (size_t b = 0; b < n; ++b)
+	  {
+	    if (a == b)
+	      continue;
+	    size_t level = 0;
+	    while (level < 3 && groups_[level][a] != groups_[level][b])
+	      ++level;
+	    // groups must nest: SMT siblings share a NUMA node, which is on
+	    // a single socket
+	    for (size_t upper = level + 1; upper < 3; ++upper)
+	      if (groups_[upper][a] != groups_[upper][b])
+		throw std::runtime_error("topology: cpus " + std::to_string(a) + " and " +
+					 std::to_string(b) + " share a " + group_name(level) +
+					 " but not a " + group_name(upper));
+	    long c = costs_[level];
+	    costs_by_pair_[a * n + b] = c;
+	    flat_ = flat_ && c == 1;
+	    min_cost_ = std::min(min_cost_, c);
+	    max_cost_ = std::max(max_cost_, c);
+	  }
+      if (n < 2)
+	min_cost_ = max_cost_ = 1;
+    }
+
+  size_t size() const { return groups_[0].size(); }
+  long cost(size_t a, size_t b) const { return costs_by_pair_[a * size() + b]; }
+  const Costs& costs() const { return costs_; }
+  // group ids per cpu of the groups a crossing of the given level (CORE,
+  // NUMA or SOCKET) leaves, i.e. cores, NUMA nodes and sockets
+  const std::vector<size_t>& groups(Level level) const { return groups_[level - 1]; }
+  const std::vector<size_t>& cores() const { return groups_[0]; }
+  const std::vector<size_t>& numas() const { return groups_[1]; }
+  const std::vector<size_t>& sockets() const { return groups_[2]; }
+  // every crossing costs 1, same as no topology
+  bool flat() const { return flat_; }
+  long min_cost() const { return min_cost_; }
+  long max_cost() const { return max_cost_; }
+
+  static std::string group_name(size_t group)
+  {
+    static const char* names[] = {"core", "NUMA node", "socket"};
+    return names[group];
+  }
+
+ private:
+  Costs costs_;
+  std::vector<size_t> groups_[3];
+  std::vector<long> costs_by_pair_;
+  bool flat_ = true;
+  long min_cost_ = 1;
+  long max_cost_ = 1;
+};
+
+
+inline std::shared_ptr<const Topology> read_lscpu_topology(const std::string& in_file,
+							   size_t cpu_num,
+							   const Topology::Costs& costs)
+{
+  // topology of cpus 0..cpu_num-1 from the output of `lscpu -p`: comma
+  // separated rows, with the column names in the last comment line
+  // (e.g. '# CPU,Core,Socket,Node,,L1d,L1i,L2,L3'); an empty Node means
+  // a single NUMA node
+  std::ifstream in(in_file);
+  if (!in)
+    throw std::runtime_error(in_file + ": cannot open topology file");
+
+  auto split = [](const std::string& line) {
+    std::vector<std::string> fields;
+    std::istringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, ','))
+      fields.push_back(field);
+    return fields;
+  };
+
+  int cols[4] = {-1, -1, -1, -1};  // CPU, Core, Node, Socket
+  std::vector<size_t> groups[3];
+  for (auto& group : groups)
+    group.assign(cpu_num, 0);
+  std::vector<char> seen(cpu_num, false);
+  std::string line;
+  size_t line_num = 0;
+  while (std::getline(in, line))
+    {
+      ++line_num;
+      if (line.empty())
+	continue;
+      if (line[0] == '#')
+	{
+	  std::vector<std::string> names = split(line.substr(1));
+	  for (size_t i = 0; i < names.size(); ++i)
+	    {
+	      std::string name = names[i];
+	      name.erase(0, name.find_first_not_of(' '));
+	      const char* known[] = {"CPU", "Core", "Node", "Socket"};
+	      for (size_t k = 0; k < 4; ++k)
+		if (name == known[k])
+		  cols[k] = i;
+	    }
+	  continue;
+	}
+      if (cols[0] < 0 || cols[1] < 0)
+	throw std::runtime_error(in_file + ": no '# CPU,Core,...' header before line " +
+				 std::to_string(line_num));
+
+      std::vector<std::string> fields = split(line);
+      long values[4] = {0, 0, 0, 0};
+      for (size_t k = 0; k < 4; ++k)
+	{
+	  if (cols[k] < 0 || (size_t) cols[k] >= fields.size() || fields[cols[k]].empty())
+	    continue;
+	  char* end;
+	  values[k] = std::strtol(fields[cols[k]].c_str(), &end, 10);
+	  if (*end != '\0' || values[k] < 0)
+	    throw std::runtime_error(in_file + ":" + std::to_string(line_num) +
+				     ": invalid value '" + fields[cols[k]] + "'");
+	}
+      size_t cpu = values[0];
+      if (cpu >= cpu_num)
+	continue;
+      seen[cpu] = true;
+      for (size_t l = 0; l < 3; ++l)
+	groups[l][cpu] = values[l + 1];
+    }
+
+  for (size_t cpu = 0; cpu < cpu_num; ++cpu)
+    if (seen[cpu] == false)
+      throw std::runtime_error(in_file + ": cpu " + std::to_string(cpu) + " not found");
+  try {
+    return std::make_shared<Topology>(groups[0], groups[1], groups[2], costs);
+  } catch (std::runtime_error& error) {
+    throw std::runtime_error(in_file + ": " + error.what());
+  }
+}
+
+
+#endif  // TOPOLOGY_H
@@ -18,43 +18,16 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <iostream>
 #include <numeric>
 #include <sstream>
+#include <string>
 
 
-struct FlowSection
-{
-  // helper struct for parsing LGF @flows section
-  std::map<std::string, std::string>& _data;
-  FlowSection(std::map<std::string, std::string>& data) : _data(data) {}
-  void operator()(const std::string& line)
-  {
-    std::istringstream ls(line);
-    std::string key, value;
-    while (ls >> key && ls >> value) _data[key] = value;
-  }
-};
-
-
-struct ConflictSection
-{
-  typedef std::pair<std::string,std::string> string_pair;
-  // helper struct for parsing LGF @conflicts section
-  std::vector<string_pair>& _data;
-  ConflictSection(std::vector<string_pair>& data) : _data(data) {}
-  void operator()(const std::string& line)
-  {
-    std::istringstream ls(line);
-    std::string u, v;
-    while (ls >> u && ls >> v)
-      _data.push_back(string_pair(u, v));
-  }
-};
-
-
-std::vector<std::string> split_string_to_vec(const std::string &input) {
+inline std::vector<std::string> split_string_to_vec(const std::string &input) {
   // based on https://stackoverflow.com/a/11719617
   std::istringstream ss(input);
   std::string token;
@@ -65,24 +38,62 @@ std::vector<std::string> split_string_to_vec(const std::string &input) {
 }
 
 
-std::string print_modules(const std::vector<Module>& modules,
-			  const std::string separator = ", ",
-			  bool name_only = true)
+inline std::ostream& print_modules(std::ostream& out,
+				   const std::vector<Module>& modules,
+				   const std::string& separator = ", ",
+				   bool name_only = true)
 {
-  std::stringstream ss;
+  // writes the module list to the stream, without a temporary string
   for (size_t i = 0; i < modules.size(); ++i)
     {
       if (i != 0)
-	ss << separator;
+	out << separator;
 
       if (name_only == true)
-	ss << modules[i].name();
+	out << modules[i].name();
       else
-	ss << modules[i];
+	out << modules[i];
     }
+  return out;
+}
+
+inline std::string print_modules(const std::vector<Module>& modules,
+				 const std::string separator = ", ",
+				 bool name_only = true)
+{
+  std::stringstream ss;
+  print_modules(ss, modules, separator, name_only);
   return ss.str();
 }
 
+inline std::string json_string(const std::string& s)
+{
+  // quoted and escaped JSON string
+  std::string retval = "\"";
+  for (char c : s)
+    {
+      switch (c)
+	{
+	case '"': retval += "\\\""; break;
+	case '\\': retval += "\\\\"; break;
+	case '\n': retval += "\\n"; break;
+	case '\t': retval += "\\t"; break;
+	case '\r': retval += "\\r"; break;
+	default:
+	  if ((unsigned char) c < 0x20)
+	    {
+	      char buf[8];
+	      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+	      retval += buf;
+	    }
+	  else
+	    retval += c;
+	}
+    }
+  return retval + "\"";
+}
+
+
 template<typename T>
 float calc_stdev(const std::vector<T>& values, float sum_values = 0.0)
 {
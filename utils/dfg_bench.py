@@ -0,0 +1,346 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2019-     Tamás Lévai    <levait@tmit.bme.hu>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+"""
+Benchmark dfg-embed: run every embedding method with both objective
+functions over a grid of generated MGW configs, and write wall time,
+peak RSS, objective value and gap to the best known value as CSV and
+JSON.
+
+"""
+import argparse
+import csv
+import itertools
+import json
+import math
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gen_mgw_lgf  # noqa: E402
+
+
+METHODS = ('ilp', 'bestfitdec', 'roundrobin', 'random', 'greedy')
+
+FIELDS = ('instance', 'modules', 'flows', 'cpus', 'conflicts', 'method',
+          'maxflow', 'repeat', 'status', 'wall_ms', 'embed_us', 'peak_rss_kb',
+          'value', 'solver_gap', 'gap')
+
+
+def parse_int_list(text):
+    """Parse a comma separated list of integers """
+    return [int(x) for x in text.split(',') if x]
+
+
+def get_grid(args):
+    """Generate the instance grid
+
+    Parameters:
+    args (Namespace): bench arguments, the grid axes are comma
+    separated lists
+
+    Returns:
+    grid (list): a dict of gen_mgw_lgf arguments per instance
+
+    """
+    grid = []
+    for users, bearers, cpus, conflicts in itertools.product(
+            parse_int_list(args.users), parse_int_list(args.bearers),
+            parse_int_list(args.cpus), parse_int_list(args.conflicts)):
+        grid.append({'usernum': users, 'bearernum': bearers,
+                     'bearer0user': max(1, users // 2), 'cpunum': cpus,
+                     'conflictnum': conflicts})
+    return grid
+
+
+def write_instance(params, slack, out_file):
+    """Generate an MGW config, with a CPU capacity that leaves the given
+    slack over the total module weight
+
+    Parameters:
+    params (dict): gen_mgw_lgf arguments
+    slack (float): total capacity / total weight
+    out_file (str): Path to write LGF
+
+    Returns:
+    config (gen_mgw_lgf.Config): the generated config
+
+    """
+    args = argparse.Namespace(cpucapacity=0, **params)
+    config = gen_mgw_lgf.create_config(args)
+    weights = [node.weight for node in config.nodes]
+    capacity = max(max(weights), math.ceil(sum(weights) * slack / params['cpunum']))
+    config.attributes['cpu_capacity'] = capacity
+    config.write_lgf(out_file)
+    return config
+
+
+def get_generate_spec(params, slack):
+    """dfg-embed -generate spec of an MGW config, built in memory by
+    dfg-embed instead of being written to and parsed from an LGF file
+
+    """
+    return ('mgw:u={usernum},b={bearernum},B={bearer0user},c={cpunum},'
+            'l={conflictnum},C=0,s={slack}'.format(slack=slack, **params))
+
+
+def count_section(lines, idx):
+    """Count the lines of an output section, up to the next empty line """
+    end = idx + 1
+    while end < len(lines) and lines[end]:
+        end += 1
+    return end - idx - 1
+
+
+def parse_output(text):
+    """Parse objective value, gap and embedding time (and the number of
+    modules and flows) from dfg-embed output
+
+    Returns:
+    result (dict): value, solver_gap, embed_us, modules, flows (None if
+    missing)
+
+    """
+    result = {'value': None, 'solver_gap': None, 'embed_us': None,
+              'modules': None, 'flows': None}
+    lines = text.splitlines()
+    for idx, line in enumerate(lines):
+        if line == '* Modules':
+            result['modules'] = count_section(lines, idx)
+        elif line == '* Flows':
+            result['flows'] = count_section(lines, idx)
+        elif line.startswith('value: ') and result['value'] is None:
+            result['value'] = int(line.split()[1])
+        elif line.startswith('gap: '):
+            result['solver_gap'] = float(line.split()[1])
+        elif line == '* Execution time' and idx + 1 < len(lines):
+            result['embed_us'] = int(lines[idx + 1].split()[0])
+    return result
+
+
+def run_once(cmd, timeout):
+    """Run dfg-embed once
+
+    Returns:
+    status (str): 'ok', 'failed' or 'timeout'
+    wall_ms (float): wall clock time
+    peak_rss_kb (int): peak resident set size of the process
+    output (str): stdout
+
+    """
+    with tempfile.TemporaryFile() as out:
+        t_before = time.perf_counter()
+        proc = subprocess.Popen(cmd, stdout=out, stderr=subprocess.DEVNULL)
+        deadline = t_before + timeout if timeout > 0 else None
+        status = 'ok'
+        while True:
+            pid, exit_status, rusage = os.wait4(proc.pid, os.WNOHANG)
+            if pid != 0:
+                break
+            if deadline is not None and time.perf_counter() > deadline:
+                proc.kill()
+                pid, exit_status, rusage = os.wait4(proc.pid, 0)
+                status = 'timeout'
+                break
+            time.sleep(0.001)
+        wall_ms = (time.perf_counter() - t_before) * 1000
+        proc.returncode = exit_status
+        if status == 'ok' and exit_status != 0:
+            status = 'failed'
+        out.seek(0)
+        output = out.read().decode(errors='replace')
+    return status, wall_ms, rusage.ru_maxrss, output
+
+
+def set_gaps(rows):
+    """Set the gap of every successful run to the best value found for
+    the same instance and objective by any method
+
+    """
+    best = {}
+    for row in rows:
+        if row['value'] is not None:
+            key = (row['instance'], row['maxflow'])
+            best[key] = min(best.get(key, row['value']), row['value'])
+    for row in rows:
+        key = (row['instance'], row['maxflow'])
+        if row['value'] is None:
+            continue
+        if best[key] == 0:
+            row['gap'] = 0.0 if row['value'] == 0 else math.inf
+        else:
+            row['gap'] = (row['value'] - best[key]) / best[key]
+
+
+def summarize(rows):
+    """Aggregate the repeats of each instance, method and objective
+
+    Returns:
+    summary (list): a dict per (instance, method, maxflow)
+
+    """
+    groups = {}
+    for row in rows:
+        key = (row['instance'], row['method'], row['maxflow'])
+        groups.setdefault(key, []).append(row)
+
+    summary = []
+    for (instance, method, maxflow), runs in groups.items():
+        done = [run for run in runs if run['status'] == 'ok']
+        walls = [run['wall_ms'] for run in done]
+        entry = {key: runs[0][key] for key in
+                 ('instance', 'modules', 'flows', 'cpus', 'conflicts')}
+        entry.update({
+            'method': method,
+            'maxflow': maxflow,
+            'runs': len(runs),
+            'ok': len(done),
+            'wall_ms_median': statistics.median(walls) if walls else None,
+            'wall_ms_min': min(walls) if walls else None,
+            'wall_ms_stdev': statistics.stdev(walls) if len(walls) > 1 else 0.0,
+            'peak_rss_kb_max': max((run['peak_rss_kb'] for run in done), default=None),
+            'value_min': min((run['value'] for run in done), default=None),
+            'gap_min': min((run['gap'] for run in done), default=None),
+        })
+        summary.append(entry)
+    return summary
+
+
+def bench(args):
+    """Run the benchmark grid
+
+    Returns:
+    rows (list): a dict per run, with the keys in FIELDS
+
+    """
+    methods = args.methods.split(',')
+    rows = []
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        for params in get_grid(args):
+            instance = ('u{usernum}-b{bearernum}-c{cpunum}-l{conflictnum}'
+                        .format(**params))
+            if args.inproc:
+                source = ['-generate', get_generate_spec(params, args.slack)]
+                meta = {'modules': None, 'flows': None, 'conflicts': None}
+            else:
+                lgf = os.path.join(tmp_dir, f'{instance}.lgf')
+                config = write_instance(params, args.slack, lgf)
+                source = ['-i', lgf]
+                meta = {'modules': len(config.nodes), 'flows': len(config.flows),
+                        'conflicts': len(config.conflicts)}
+            for method, maxflow in itertools.product(methods, (False, True)):
+                for repeat in range(args.repeats):
+                    cmd = [args.prog] + source + ['-m', method, '-seed', str(repeat)]
+                    if maxflow:
+                        cmd.append('-maxflow')
+                    if method == 'ilp' and args.timelimit > 0:
+                        cmd.extend(['-timelimit', str(args.timelimit)])
+                    status, wall_ms, peak_rss_kb, output = run_once(cmd, args.timeout)
+                    row = {
+                        'instance': instance,
+                        'cpus': params['cpunum'],
+                        'method': method,
+                        'maxflow': int(maxflow),
+                        'repeat': repeat,
+                        'status': status,
+                        'wall_ms': round(wall_ms, 3),
+                        'peak_rss_kb': peak_rss_kb,
+                        'gap': None,
+                    }
+                    row.update(meta)
+                    if status == 'ok':
+                        parsed = parse_output(output)
+                        for key in ('modules', 'flows'):
+                            if row[key] is None:
+                                row[key] = parsed[key]
+                        row.update({key: parsed[key] for key in
+                                    ('value', 'solver_gap', 'embed_us')})
+                    else:
+                        row.update({'value': None, 'solver_gap': None,
+                                    'embed_us': None})
+                    rows.append(row)
+                    if not args.quiet:
+                        print(f"{instance} {method} maxflow={int(maxflow)} "
+                              f"#{repeat}: {status} {wall_ms:.1f} ms "
+                              f"value={row['value']}", file=sys.stderr)
+    set_gaps(rows)
+    return rows
+
+
+def write_csv(rows, out_file):
+    """Write one line per run """
+    with open(out_file, 'w', newline='') as outfile:
+        writer = csv.DictWriter(outfile, fieldnames=FIELDS)
+        writer.writeheader()
+        for row in rows:
+            writer.writerow({key: '' if row[key] is None else row[key]
+                             for key in FIELDS})
+
+
+def write_json(rows, out_file):
+    """Write all runs and the per-configuration summary """
+    def finite(value):
+        return None if isinstance(value, float) and math.isinf(value) else value
+    runs = [{key: finite(row[key]) for key in FIELDS} for row in rows]
+    summary = [{key: finite(val) for key, val in entry.items()}
+               for entry in summarize(rows)]
+    with open(out_file, 'w') as outfile:
+        json.dump({'runs': runs, 'summary': summary}, outfile, indent=2)
+        outfile.write('\n')
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--prog', '-p', type=str, default='./dfg-embed',
+                        help='dfg-embed binary')
+    parser.add_argument('--methods', '-m', type=str, default=','.join(METHODS),
+                        help='Comma separated embedding methods')
+    parser.add_argument('--users', '-u', type=str, default='2,4,8',
+                        help='Comma separated numbers of users')
+    parser.add_argument('--bearers', '-b', type=str, default='2,4',
+                        help='Comma separated numbers of bearers')
+    parser.add_argument('--cpus', '-c', type=str, default='5,10',
+                        help='Comma separated numbers of CPUs')
+    parser.add_argument('--conflicts', '-l', type=str, default='0,1',
+                        help='Comma separated numbers of CPU failures to cover')
+    parser.add_argument('--slack', '-s', type=float, default=1.5,
+                        help='Total CPU capacity / total module weight')
+    parser.add_argument('--repeats', '-r', type=int, default=3,
+                        help='Runs per instance, method and objective')
+    parser.add_argument('--timelimit', '-t', type=float, default=60,
+                        help='ILP time limit [s], 0: no limit')
+    parser.add_argument('--timeout', '-T', type=float, default=300,
+                        help='Wall clock limit of a run [s], 0: no limit')
+    parser.add_argument('--csv', type=str, default='dfg-bench.csv',
+                        help='Outfile (CSV)')
+    parser.add_argument('--json', type=str, default='dfg-bench.json',
+                        help='Outfile (JSON)')
+    parser.add_argument('--inproc', '-g', action='store_true',
+                        help='Let dfg-embed generate the configs in memory '
+                        '(-generate) instead of reading LGF files')
+    parser.add_argument('--quiet', '-q', action='store_true',
+                        help='Do not print progress to stderr')
+    args_parsed = parser.parse_args()
+
+    results = bench(args_parsed)
+    if args_parsed.csv:
+        write_csv(results, args_parsed.csv)
+    if args_parsed.json:
+        write_json(results, args_parsed.json)